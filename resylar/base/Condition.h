@@ -23,10 +23,18 @@ class Condition : noncopyable {
     abstime.tv_sec += static_cast<time_t>(seconds);
     return ETIMEDOUT == pthread_cond_timedwait(&cond, mutex.get(), &abstime);
   }
+  bool waitForMilliseconds(int64_t ms) {
+    struct timespec abstime;
+    clock_gettime(CLOCK_REALTIME, &abstime);
+    int64_t nsec = abstime.tv_nsec + (ms % 1000) * 1000000;
+    abstime.tv_sec += static_cast<time_t>(ms / 1000 + nsec / 1000000000);
+    abstime.tv_nsec = static_cast<long>(nsec % 1000000000);
+    return ETIMEDOUT == pthread_cond_timedwait(&cond, mutex.get(), &abstime);
+  }
 
  private:
   MutexLock &mutex;
   pthread_cond_t cond;
 };
 
-}
\ No newline at end of file
+}
\ No newline at end of file
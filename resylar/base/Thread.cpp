@@ -3,6 +3,7 @@
 #include "Thread.h"
 #include <assert.h>
 #include <errno.h>
+#include <sched.h>
 #include <linux/unistd.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -94,7 +95,17 @@ void Thread::start() {
   assert(!started_);
   started_ = true;
   ThreadData* data = new ThreadData(func_, name_, &tid_, &latch_);
-  if (pthread_create(&pthreadId_, NULL, &startThread, data)) {
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  if (!cpus_.empty()) {
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    for (int cpu : cpus_) CPU_SET(cpu, &cpuset);
+    pthread_attr_setaffinity_np(&attr, sizeof(cpuset), &cpuset);
+  }
+  int rt = pthread_create(&pthreadId_, &attr, &startThread, data);
+  pthread_attr_destroy(&attr);
+  if (rt) {
     started_ = false;
     delete data;
   } else {
@@ -109,4 +120,4 @@ int Thread::join() {
   joined_ = true;
   return pthread_join(pthreadId_, NULL);
 }
-}
\ No newline at end of file
+}
\ No newline at end of file
@@ -7,6 +7,7 @@
 #include <functional>
 #include <memory>
 #include <string>
+#include <vector>
 #include "CountDownLatch.h"
 #include "noncopyable.h"
 
@@ -17,6 +18,8 @@ class Thread : noncopyable {
   typedef std::function<void()> ThreadFunc;
   explicit Thread(const ThreadFunc&, const std::string& name = std::string());
   ~Thread();
+  // 需要在start()之前调用，线程创建时就绑定到cpus上
+  void setCpuAffinity(const std::vector<int>& cpus) { cpus_ = cpus; }
   void start();
   int join();
   bool started() const { return started_; }
@@ -31,6 +34,7 @@ class Thread : noncopyable {
   pid_t tid_;
   ThreadFunc func_;
   std::string name_;
+  std::vector<int> cpus_;
   CountDownLatch latch_;
 };
-}
\ No newline at end of file
+}
\ No newline at end of file
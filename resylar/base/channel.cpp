@@ -0,0 +1,178 @@
+#include "channel.h"
+#include <assert.h>
+#include "Logging.h"
+#include "scheduler.h"
+
+namespace myconcurrent{
+
+ChannelWaiter::ChannelWaiter()
+    :m_cond(m_mutex)
+{
+    if(Scheduler::InFiber()){
+        m_fiber = Fiber::GetThis();
+        m_scheduler = Scheduler::GetThis();
+    }
+}
+
+void ChannelWaiter::wake(ChannelBase *channel, bool is_send){
+    m_waker = channel;
+    m_wakerIsSend = is_send;
+    if(m_fiber){
+        //*协程还没切出去就被取到时，调度器会把它放回队尾
+        m_scheduler->schedule(m_fiber);
+    }else{
+        MutexLockGuard lock(m_mutex);
+        m_woken = true;
+        m_cond.notify();
+    }
+}
+
+void ChannelWaiter::park(){
+    if(m_fiber){
+        m_fiber->yield();
+    }else{
+        MutexLockGuard lock(m_mutex);
+        while(!m_woken)
+            m_cond.wait();
+        m_woken = false;
+    }
+}
+
+void ChannelBase::WaitList::push(ChannelCase::Node *node){
+    node->prev = tail;
+    node->next = nullptr;
+    if(tail)
+        tail->next = node;
+    else
+        head = node;
+    tail = node;
+    node->linked = true;
+}
+
+void ChannelBase::WaitList::remove(ChannelCase::Node *node){
+    if(node->prev)
+        node->prev->next = node->next;
+    else
+        head = node->next;
+    if(node->next)
+        node->next->prev = node->prev;
+    else
+        tail = node->prev;
+    node->prev = node->next = nullptr;
+    node->linked = false;
+}
+
+ChannelCase::Node *ChannelBase::WaitList::pop(){
+    ChannelCase::Node *node = head;
+    if(node)
+        remove(node);
+    return node;
+}
+
+ChannelBase::ChannelBase(size_t capacity)
+    :m_capacity(capacity)
+{
+    if(capacity == 0){
+        LOG_ERROR<<"Channel capacity must be greater than 0";
+        assert(false);
+    }
+}
+
+void ChannelBase::close(){
+    MutexLockGuard lock(m_mutex);
+    if(m_closed)
+        return;
+    m_closed = true;
+    wakeAllLocked(m_senders);
+    wakeAllLocked(m_receivers);
+}
+
+bool ChannelBase::isClosed(){
+    MutexLockGuard lock(m_mutex);
+    return m_closed;
+}
+
+void ChannelBase::wakeOneLocked(WaitList &list){
+    while(ChannelCase::Node *node = list.pop()){
+        if(node->waiter->claim()){
+            node->waiter->wake(this, &list == &m_senders);
+            return;
+        }
+    }
+}
+
+void ChannelBase::wakeAllLocked(WaitList &list){
+    while(ChannelCase::Node *node = list.pop()){
+        if(node->waiter->claim())
+            node->waiter->wake(this, &list == &m_senders);
+    }
+}
+
+void ChannelBase::passWakeup(bool is_send){
+    MutexLockGuard lock(m_mutex);
+    if(readyLocked(is_send))
+        wakeOneLocked(is_send ? m_senders : m_receivers);
+}
+
+/**
+ * *先不加等待者把所有分支试一遍；都没就绪时把等待者挂到每个通道上，检查和挂入在同一把锁内，不会丢失唤醒
+ * *挂的过程中发现某个分支就绪，要先claim自己：抢到了说明没有通道会再唤醒自己，可以直接执行；
+ * *没抢到说明已经有通道唤醒了自己(协程已经被加入调度)，必须先挂起把这次唤醒消耗掉再重试
+ * *通道每次只唤醒一个等待者，被唤醒后完成的却是另一个通道上的分支时，要把这次唤醒转回原来的通道，
+ * *否则原来通道上的数据(或空位)留着，排在后面的等待者不会再被唤醒
+ */
+int ChannelBase::Run(ChannelCase *cases, size_t n, bool block){
+    for(size_t i = 0; i < n; ++i){
+        ChannelBase *ch = cases[i].channel;
+        MutexLockGuard lock(ch->m_mutex);
+        if(ch->readyLocked(cases[i].isSend)){
+            cases[i].op(ch, cases[i].data, cases[i].ok);
+            return (int)i;
+        }
+    }
+    if(!block)
+        return -1;
+
+    ChannelWaiter waiter;
+    ChannelBase *waker = nullptr;
+    bool waker_is_send = false;
+    while(true){
+        int done = -1;
+        bool woken = false;
+        for(size_t i = 0; i < n && done < 0 && !woken; ++i){
+            ChannelCase &c = cases[i];
+            ChannelBase *ch = c.channel;
+            MutexLockGuard lock(ch->m_mutex);
+            if(!ch->readyLocked(c.isSend)){
+                c.node.waiter = &waiter;
+                (c.isSend ? ch->m_senders : ch->m_receivers).push(&c.node);
+            }else if(waiter.claim()){
+                c.op(ch, c.data, c.ok);
+                done = (int)i;
+            }else{
+                woken = true;
+            }
+        }
+        if(done < 0){
+            waiter.park();
+            waker = waiter.waker();
+            waker_is_send = waiter.wakerIsSend();
+        }
+        //*从还挂着的通道上摘下来
+        for(size_t i = 0; i < n; ++i){
+            ChannelCase &c = cases[i];
+            ChannelBase *ch = c.channel;
+            MutexLockGuard lock(ch->m_mutex);
+            if(c.node.linked)
+                (c.isSend ? ch->m_senders : ch->m_receivers).remove(&c.node);
+        }
+        if(done >= 0){
+            if(waker && (waker != cases[done].channel || waker_is_send != cases[done].isSend))
+                waker->passWakeup(waker_is_send);
+            return done;
+        }
+        waiter.reset();
+    }
+}
+
+}//myconcurrent
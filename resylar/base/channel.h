@@ -0,0 +1,272 @@
+#pragma once
+#include <atomic>
+#include <utility>
+#include <vector>
+#include "Condition.h"
+#include "MutexLock.h"
+#include "fiber.h"
+#include "noncopyable.h"
+#include "ring_queue.h"
+
+/**
+ * *协程之间传递数据的有界MPMC通道
+ * *缓冲区满时send挂起发送协程，空时recv挂起接收协程，对端操作后通过Scheduler::schedule恢复；
+ * *不在调度器协程中调用时退化为阻塞线程
+ * *Select可以同时等待多个通道上的收发，哪个先就绪执行哪个
+ */
+namespace myconcurrent{
+
+class Scheduler;
+class ChannelBase;
+
+/**
+ * *一次阻塞等待的等待者，select时同时挂在多个通道上
+ * *通道唤醒前先claim()，只有抢到的一方负责唤醒，其余的直接丢弃
+ */
+class ChannelWaiter : noncopyable{
+public:
+    ChannelWaiter();
+
+    //*抢占唤醒权
+    bool claim(){
+        bool expected = false;
+        return m_fired.compare_exchange_strong(expected, true, std::memory_order_acq_rel);
+    }
+
+    //*claim()成功后唤醒等待者，记下是哪个通道的哪一侧唤醒的
+    void wake(ChannelBase *channel, bool is_send);
+
+    //*最近一次唤醒自己的通道，park()返回后读取
+    ChannelBase *waker() const { return m_waker; }
+    bool wakerIsSend() const { return m_wakerIsSend; }
+
+    //*挂起直到被wake()
+    void park();
+
+    //*从所有通道摘下之后，重新等待之前调用
+    void reset() { m_fired.store(false, std::memory_order_release); }
+
+private:
+    std::atomic<bool> m_fired = {false};
+    ChannelBase *m_waker = nullptr;
+    bool m_wakerIsSend = false;
+    //*在协程中等待
+    Fiber::ptr m_fiber;
+    Scheduler *m_scheduler = nullptr;
+    //*在线程中等待
+    MutexLock m_mutex;
+    Condition m_cond;
+    bool m_woken = false;
+};
+
+/**
+ * *select的一个分支，也用于单个通道的send/recv
+ */
+struct ChannelCase{
+    //*挂在通道等待队列上的节点
+    struct Node{
+        Node *prev = nullptr;
+        Node *next = nullptr;
+        ChannelWaiter *waiter = nullptr;
+        bool linked = false;
+    };
+
+    ChannelBase *channel;
+    bool isSend;
+    //*发送的值或接收的位置
+    void *data;
+    //*持有通道锁时执行，通道已经就绪
+    void (*op)(ChannelBase *channel, void *data, bool *ok);
+    //*分支完成时写入，false表示通道已关闭
+    bool *ok;
+    Node node;
+};
+
+class ChannelBase : noncopyable{
+public:
+    explicit ChannelBase(size_t capacity);
+    virtual ~ChannelBase() {}
+
+    //*关闭通道，唤醒所有等待者；之后send失败，recv取完剩余数据后失败
+    void close();
+
+    bool isClosed();
+
+    size_t capacity() const { return m_capacity; }
+
+    /**
+     * *执行cases中第一个就绪的分支，返回分支序号
+     * *block为false时没有就绪的分支返回-1，否则挂起等待
+     */
+    static int Run(ChannelCase *cases, size_t n, bool block);
+
+protected:
+    //*等待队列，m_mutex保护
+    struct WaitList{
+        ChannelCase::Node *head = nullptr;
+        ChannelCase::Node *tail = nullptr;
+
+        void push(ChannelCase::Node *node);
+        void remove(ChannelCase::Node *node);
+        ChannelCase::Node *pop();
+    };
+
+    //*持有m_mutex时，当前缓冲区中的数据个数
+    virtual size_t sizeLocked() const = 0;
+
+    //*持有m_mutex时分支是否可以立即完成(包括通道已关闭)
+    bool readyLocked(bool is_send) const{
+        if(m_closed)
+            return true;
+        return is_send ? sizeLocked() < m_capacity : sizeLocked() > 0;
+    }
+
+    //*唤醒一个等待者，跳过已经被其他通道唤醒的
+    void wakeOneLocked(WaitList &list);
+    void wakeAllLocked(WaitList &list);
+
+    //*被本通道唤醒的select最终完成了别的分支，本通道这一侧还就绪时把唤醒转给下一个等待者
+    void passWakeup(bool is_send);
+
+protected:
+    MutexLock m_mutex;
+    const size_t m_capacity;
+    bool m_closed = false;
+    //*等待缓冲区有空位的发送者，等待数据的接收者
+    WaitList m_senders;
+    WaitList m_receivers;
+};
+
+template <class T>
+class Channel : public ChannelBase{
+public:
+    explicit Channel(size_t capacity) : ChannelBase(capacity) {}
+
+    //*发送，缓冲区满时挂起；通道已关闭返回false
+    bool send(T value){
+        bool ok = false;
+        ChannelCase c = MakeSend(value, &ok);
+        Run(&c, 1, true);
+        return ok;
+    }
+
+    //*接收，没有数据时挂起；通道已关闭并且取完返回false
+    bool recv(T &out){
+        bool ok = false;
+        ChannelCase c = MakeRecv(out, &ok);
+        Run(&c, 1, true);
+        return ok;
+    }
+
+    //*不等待的发送，失败时value保持不变
+    bool trySend(T &value){
+        bool ok = false;
+        ChannelCase c = MakeSend(value, &ok);
+        return Run(&c, 1, false) == 0 && ok;
+    }
+
+    bool trySend(T &&value){
+        return trySend(value);
+    }
+
+    //*不等待的接收
+    bool tryRecv(T &out){
+        bool ok = false;
+        ChannelCase c = MakeRecv(out, &ok);
+        return Run(&c, 1, false) == 0 && ok;
+    }
+
+    size_t size(){
+        MutexLockGuard lock(m_mutex);
+        return m_buffer.size();
+    }
+
+private:
+    friend class Select;
+
+    ChannelCase MakeSend(T &value, bool *ok){
+        ChannelCase c;
+        c.channel = this;
+        c.isSend = true;
+        c.data = &value;
+        c.op = &SendOp;
+        c.ok = ok;
+        return c;
+    }
+
+    ChannelCase MakeRecv(T &out, bool *ok){
+        ChannelCase c;
+        c.channel = this;
+        c.isSend = false;
+        c.data = &out;
+        c.op = &RecvOp;
+        c.ok = ok;
+        return c;
+    }
+
+    static void SendOp(ChannelBase *channel, void *data, bool *ok){
+        Channel *self = static_cast<Channel *>(channel);
+        if(self->m_closed){
+            *ok = false;
+            return;
+        }
+        self->m_buffer.push_back(std::move(*static_cast<T *>(data)));
+        self->wakeOneLocked(self->m_receivers);
+        *ok = true;
+    }
+
+    static void RecvOp(ChannelBase *channel, void *data, bool *ok){
+        Channel *self = static_cast<Channel *>(channel);
+        if(self->m_buffer.empty()){
+            *ok = false;
+            return;
+        }
+        *static_cast<T *>(data) = std::move(self->m_buffer.front());
+        self->m_buffer.pop_front();
+        self->wakeOneLocked(self->m_senders);
+        *ok = true;
+    }
+
+    size_t sizeLocked() const override { return m_buffer.size(); }
+
+private:
+    RingQueue<T> m_buffer;
+};
+
+/**
+ * *同时等待多个通道
+ * *Select sel;
+ * *sel.recv(a, x).send(b, y);
+ * *int idx = sel.wait();     //返回完成的分支序号
+ */
+class Select : noncopyable{
+public:
+    //*接收分支，ok为false表示通道已关闭
+    template <class T>
+    Select &recv(Channel<T> &channel, T &out, bool *ok = nullptr){
+        m_cases.push_back(channel.MakeRecv(out, slot(ok)));
+        return *this;
+    }
+
+    //*发送分支，完成时value被移走
+    template <class T>
+    Select &send(Channel<T> &channel, T &value, bool *ok = nullptr){
+        m_cases.push_back(channel.MakeSend(value, slot(ok)));
+        return *this;
+    }
+
+    //*等待任意一个分支完成，返回分支序号
+    int wait() { return ChannelBase::Run(m_cases.data(), m_cases.size(), true); }
+
+    //*没有就绪的分支时返回-1
+    int tryWait() { return ChannelBase::Run(m_cases.data(), m_cases.size(), false); }
+
+private:
+    bool *slot(bool *ok) { return ok ? ok : &m_ignored; }
+
+private:
+    std::vector<ChannelCase> m_cases;
+    bool m_ignored = false;
+};
+
+}//myconcurrent
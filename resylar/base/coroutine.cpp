@@ -0,0 +1,143 @@
+#include "coroutine.h"
+
+#if defined(__cpp_impl_coroutine)
+
+#include <errno.h>
+#include <unistd.h>
+
+namespace myconcurrent{
+
+namespace co_detail{
+
+bool IoAwaiter::tryOnce(){
+    do{
+        m_result = attempt();
+    }while(m_result == -1 && errno == EINTR);
+    if(m_result != -1)
+        return false;
+    m_error = errno;
+    return m_error == EAGAIN || m_error == EWOULDBLOCK;
+}
+
+bool IoAwaiter::await_suspend(std::coroutine_handle<> h){
+    m_handle = h;
+    m_iom = IOManager::GetThis();
+    if(!m_iom){
+        LOG_ERROR<<"co io on fd="<<m_fd<<" outside IOManager";
+        assert(false);
+    }
+    if(m_timeout != ~0ull){
+        m_timedOut = std::make_shared<std::atomic<bool>>(false);
+        std::weak_ptr<std::atomic<bool>> weak(m_timedOut);
+        IOManager *iom = m_iom;
+        int fd = m_fd;
+        IOManager::Event event = m_event;
+        //*cancelEvent会触发一次事件回调，回调里看到超时标记后恢复协程
+        m_timer = iom->addConditionTimer(m_timeout, [weak, iom, fd, event](){
+            std::shared_ptr<std::atomic<bool>> timedOut = weak.lock();
+            if(!timedOut || timedOut->exchange(true))
+                return;
+            iom->cancelEvent(fd, event);
+        }, weak);
+    }
+    if(arm())
+        return true;
+    if(m_timer)
+        m_timer->cancel();
+    return false;
+}
+
+ssize_t IoAwaiter::await_resume(){
+    //*协程可能换了线程，errno在恢复的线程上设置
+    if(m_timer)
+        m_timer->cancel();
+    if(m_result == -1)
+        errno = m_error;
+    return m_result;
+}
+
+bool IoAwaiter::arm(){
+    //*注册成功后事件随时可能触发并恢复协程，之后不能再访问成员
+    std::shared_ptr<std::atomic<bool>> timedOut = m_timedOut;
+    IOManager *iom = m_iom;
+    int fd = m_fd;
+    IOManager::Event event = m_event;
+    if(iom->addEvent(fd, event, [this](){ onEvent(); })){
+        m_result = -1;
+        m_error = errno ? errno : EINVAL;
+        return false;
+    }
+    //*超时发生在上一次事件回调和这次注册之间时，定时器的cancelEvent扑了空，这里补上
+    if(timedOut && timedOut->load())
+        iom->cancelEvent(fd, event);
+    return true;
+}
+
+void IoAwaiter::onEvent(){
+    if(m_timedOut && m_timedOut->load()){
+        m_result = -1;
+        m_error = ETIMEDOUT;
+    }else if(tryOnce() && arm()){
+        //*假唤醒，已经重新注册
+        return;
+    }
+    m_handle.resume();
+}
+
+ssize_t ReadAwaiter::attempt(){
+    return ::read(fd(), m_buf, m_len);
+}
+
+ssize_t WriteAwaiter::attempt(){
+    return ::write(fd(), m_buf, m_len);
+}
+
+ssize_t AcceptAwaiter::attempt(){
+    return ::accept4(fd(), m_addr, m_addrlen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+}
+
+ssize_t ConnectAwaiter::attempt(){
+    if(!m_started){
+        m_started = true;
+        if(::connect(fd(), m_addr, m_addrlen) == 0)
+            return 0;
+        //*被信号打断的connect同样在后台继续
+        if(errno == EINPROGRESS || errno == EINTR)
+            errno = EAGAIN;
+        return -1;
+    }
+    int error = 0;
+    socklen_t len = sizeof(error);
+    if(::getsockopt(fd(), SOL_SOCKET, SO_ERROR, &error, &len) == -1)
+        return -1;
+    if(error){
+        errno = error;
+        return -1;
+    }
+    return 0;
+}
+
+ssize_t ReadyAwaiter::attempt(){
+    if(!m_waited){
+        m_waited = true;
+        errno = EAGAIN;
+        return -1;
+    }
+    return 0;
+}
+
+void SleepAwaiter::await_suspend(std::coroutine_handle<> h){
+    IOManager *iom = IOManager::GetThis();
+    if(!iom){
+        LOG_ERROR<<"co::sleep outside IOManager";
+        assert(false);
+    }
+    //*定时器回调本身就在调度器线程上执行
+    iom->addTimer(m_ms, [h](){ h.resume(); });
+}
+
+}//co_detail
+
+}//myconcurrent
+
+#endif
@@ -0,0 +1,437 @@
+#pragma once
+
+/**
+ * *C++20无栈协程前端
+ * *Fiber每个协程独占一块栈，切换要保存整套上下文；连接数很多且大多空闲时，栈内存是主要开销
+ * *Task<T>是无栈协程，挂起时只保留编译器生成的协程帧，恢复时在调度器线程当前的栈上直接resume
+ * *co::read/write/accept/connect在fd就绪时由IOManager::addEvent的回调恢复，co::sleep由定时器恢复
+ * *co::spawn把Task交给调度器执行并返回Future，Fiber中可以get()等它；Task中也可以co_await一个Future
+ * *需要-std=c++20，低版本编译时本头文件为空
+ */
+#if defined(__cpp_impl_coroutine)
+
+#include <assert.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <coroutine>
+#include <exception>
+#include <memory>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include "future.h"
+#include "iomanager.h"
+
+namespace myconcurrent{
+
+template <class T = void> class Task;
+
+namespace co_detail{
+
+//*和结果类型无关的部分：等待者和异常
+struct PromiseBase{
+    //*结束时直接切换到等待这个Task的协程，不经过调度器
+    struct FinalAwaiter{
+        bool await_ready() noexcept { return false; }
+
+        template <class P>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept{
+            std::coroutine_handle<> next = h.promise().continuation;
+            return next ? next : std::noop_coroutine();
+        }
+
+        void await_resume() noexcept {}
+    };
+
+    //*Task是惰性的，被co_await或者spawn之后才开始执行
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    FinalAwaiter final_suspend() noexcept { return {}; }
+    void unhandled_exception() { error = std::current_exception(); }
+
+    std::coroutine_handle<> continuation;
+    std::exception_ptr error;
+};
+
+template <class T>
+struct TaskPromise : PromiseBase{
+    Task<T> get_return_object() noexcept;
+
+    template <class U>
+    void return_value(U &&v) { value.emplace(std::forward<U>(v)); }
+
+    T result(){
+        if(error)
+            std::rethrow_exception(error);
+        return std::move(*value);
+    }
+
+    std::optional<T> value;
+};
+
+template <>
+struct TaskPromise<void> : PromiseBase{
+    Task<void> get_return_object() noexcept;
+
+    void return_void() {}
+
+    void result(){
+        if(error)
+            std::rethrow_exception(error);
+    }
+};
+
+//*spawn用的外层协程：创建时挂起，等调度器执行；结束时自己销毁协程帧
+struct Detached{
+    struct promise_type{
+        Detached get_return_object() noexcept{
+            return Detached{std::coroutine_handle<promise_type>::from_promise(*this)};
+        }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+
+    std::coroutine_handle<promise_type> handle;
+};
+
+//*在调度器上恢复协程，协程在执行回调的那个线程上继续运行
+inline void ResumeOn(Scheduler *scheduler, std::coroutine_handle<> h){
+    scheduler->schedule([h](){ h.resume(); });
+}
+
+/**
+ * *fd上的一次非阻塞IO：先直接尝试，EAGAIN时注册事件挂起；事件回调中重试，成功、出错或超时之后才恢复协程
+ * *重试放在回调里，协程不会因为假唤醒被恢复之后再挂起一次
+ * *fd需要是非阻塞的；结果和对应的系统调用一样，失败返回-1并设置errno，超时为ETIMEDOUT
+ */
+class IoAwaiter{
+public:
+    IoAwaiter(int fd, IOManager::Event event, uint64_t timeout_ms)
+        :m_fd(fd), m_event(event), m_timeout(timeout_ms) {}
+
+    IoAwaiter(const IoAwaiter &) = delete;
+    IoAwaiter &operator=(const IoAwaiter &) = delete;
+
+    //*能直接完成时不挂起
+    bool await_ready() { return !tryOnce(); }
+
+    bool await_suspend(std::coroutine_handle<> h);
+
+    ssize_t await_resume();
+
+protected:
+    ~IoAwaiter() = default;
+
+    //*执行一次系统调用，需要等待时返回-1并把errno设为EAGAIN
+    virtual ssize_t attempt() = 0;
+
+    int fd() const { return m_fd; }
+
+private:
+    //*执行attempt()，返回是否需要等待，结果记在m_result和m_error中
+    bool tryOnce();
+
+    //*注册事件，失败时记下错误返回false
+    bool arm();
+
+    //*事件触发或者被超时取消
+    void onEvent();
+
+private:
+    int m_fd;
+    IOManager::Event m_event;
+    uint64_t m_timeout;
+    IOManager *m_iom = nullptr;
+    std::coroutine_handle<> m_handle;
+    //*超时标记，定时器只持有弱引用，协程恢复后定时器不会再访问等待者
+    std::shared_ptr<std::atomic<bool>> m_timedOut;
+    Timer::ptr m_timer;
+    ssize_t m_result = 0;
+    int m_error = 0;
+};
+
+class ReadAwaiter final : public IoAwaiter{
+public:
+    ReadAwaiter(int fd, void *buf, size_t len, uint64_t timeout_ms)
+        :IoAwaiter(fd, IOManager::READ, timeout_ms), m_buf(buf), m_len(len) {}
+
+private:
+    ssize_t attempt() override;
+
+    void *m_buf;
+    size_t m_len;
+};
+
+class WriteAwaiter final : public IoAwaiter{
+public:
+    WriteAwaiter(int fd, const void *buf, size_t len, uint64_t timeout_ms)
+        :IoAwaiter(fd, IOManager::WRITE, timeout_ms), m_buf(buf), m_len(len) {}
+
+private:
+    ssize_t attempt() override;
+
+    const void *m_buf;
+    size_t m_len;
+};
+
+class AcceptAwaiter final : public IoAwaiter{
+public:
+    AcceptAwaiter(int fd, sockaddr *addr, socklen_t *addrlen, uint64_t timeout_ms)
+        :IoAwaiter(fd, IOManager::READ, timeout_ms), m_addr(addr), m_addrlen(addrlen) {}
+
+private:
+    ssize_t attempt() override;
+
+    sockaddr *m_addr;
+    socklen_t *m_addrlen;
+};
+
+class ConnectAwaiter final : public IoAwaiter{
+public:
+    ConnectAwaiter(int fd, const sockaddr *addr, socklen_t addrlen, uint64_t timeout_ms)
+        :IoAwaiter(fd, IOManager::WRITE, timeout_ms), m_addr(addr), m_addrlen(addrlen) {}
+
+private:
+    //*第一次调用connect，之后可写时用SO_ERROR取结果
+    ssize_t attempt() override;
+
+    const sockaddr *m_addr;
+    socklen_t m_addrlen;
+    bool m_started = false;
+};
+
+class ReadyAwaiter final : public IoAwaiter{
+public:
+    ReadyAwaiter(int fd, IOManager::Event event, uint64_t timeout_ms)
+        :IoAwaiter(fd, event, timeout_ms) {}
+
+private:
+    //*第一次总是等待，事件触发后返回0
+    ssize_t attempt() override;
+
+    bool m_waited = false;
+};
+
+class SleepAwaiter{
+public:
+    explicit SleepAwaiter(uint64_t ms) : m_ms(ms) {}
+
+    bool await_ready() noexcept { return false; }
+
+    void await_suspend(std::coroutine_handle<> h);
+
+    void await_resume() noexcept {}
+
+private:
+    uint64_t m_ms;
+};
+
+class ScheduleAwaiter{
+public:
+    explicit ScheduleAwaiter(Scheduler *scheduler) : m_scheduler(scheduler) {}
+
+    bool await_ready() noexcept { return false; }
+
+    void await_suspend(std::coroutine_handle<> h) { ResumeOn(m_scheduler, h); }
+
+    void await_resume() noexcept {}
+
+private:
+    Scheduler *m_scheduler;
+};
+
+/**
+ * *在Task中等待Future：注册完成回调，不占用协程栈
+ * *完成后在等待时所在的调度器上恢复，不在调度器中时在设置结果的线程里直接恢复
+ */
+template <class T>
+class FutureAwaiter : private FutureStateBase::Continuation{
+public:
+    explicit FutureAwaiter(Future<T> &&future)
+        :m_future(std::move(future)), m_scheduler(Scheduler::GetThis()) {}
+
+    bool await_ready() const { return m_future.isReady(); }
+
+    //*注册时已经就绪则不挂起
+    bool await_suspend(std::coroutine_handle<> h){
+        m_handle = h;
+        run = &FutureAwaiter::Wake;
+        return m_future.subscribe(this);
+    }
+
+    T await_resume() { return m_future.get(); }
+
+private:
+    static void Wake(FutureStateBase::Continuation *c){
+        //*恢复之后等待者随时可能失效，先取出需要的字段
+        FutureAwaiter *self = static_cast<FutureAwaiter *>(c);
+        std::coroutine_handle<> h = self->m_handle;
+        Scheduler *scheduler = self->m_scheduler;
+        if(scheduler)
+            ResumeOn(scheduler, h);
+        else
+            h.resume();
+    }
+
+private:
+    Future<T> m_future;
+    Scheduler *m_scheduler;
+    std::coroutine_handle<> m_handle;
+};
+
+}//co_detail
+
+/**
+ * *无栈协程，只能移动；惰性启动，co_await时开始执行，结束后直接切回等待者
+ * *异常在co_await处原样抛出
+ */
+template <class T>
+class Task{
+public:
+    typedef co_detail::TaskPromise<T> promise_type;
+    typedef std::coroutine_handle<promise_type> handle_type;
+
+    Task() = default;
+    explicit Task(handle_type h) : m_handle(h) {}
+
+    Task(Task &&other) noexcept : m_handle(other.m_handle) { other.m_handle = nullptr; }
+
+    Task &operator=(Task &&other) noexcept{
+        if(this != &other){
+            if(m_handle)
+                m_handle.destroy();
+            m_handle = other.m_handle;
+            other.m_handle = nullptr;
+        }
+        return *this;
+    }
+
+    Task(const Task &) = delete;
+    Task &operator=(const Task &) = delete;
+
+    ~Task(){
+        if(m_handle)
+            m_handle.destroy();
+    }
+
+    bool valid() const { return (bool)m_handle; }
+
+    bool done() const { return m_handle && m_handle.done(); }
+
+    struct Awaiter{
+        handle_type handle;
+
+        bool await_ready() noexcept { return handle.done(); }
+
+        //*对称转移：直接切到被等待的Task，它结束时再切回来，不经过调度器
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) noexcept{
+            handle.promise().continuation = caller;
+            return handle;
+        }
+
+        T await_resume() { return handle.promise().result(); }
+    };
+
+    Awaiter operator co_await() const noexcept{
+        assert(m_handle);
+        return Awaiter{m_handle};
+    }
+
+private:
+    handle_type m_handle;
+};
+
+namespace co_detail{
+
+template <class T>
+inline Task<T> TaskPromise<T>::get_return_object() noexcept{
+    return Task<T>(std::coroutine_handle<TaskPromise<T>>::from_promise(*this));
+}
+
+inline Task<void> TaskPromise<void>::get_return_object() noexcept{
+    return Task<void>(std::coroutine_handle<TaskPromise<void>>::from_promise(*this));
+}
+
+template <class T>
+Detached RunDetached(Task<T> task, Promise<T> promise){
+    try{
+        if constexpr (std::is_void_v<T>){
+            co_await task;
+            promise.setValue();
+        }else{
+            promise.setValue(co_await task);
+        }
+    }catch(...){
+        promise.setException(std::current_exception());
+    }
+}
+
+}//co_detail
+
+//*等待Future，Future被移走；co_await std::move(future)
+template <class T>
+co_detail::FutureAwaiter<T> operator co_await(Future<T> &&future){
+    return co_detail::FutureAwaiter<T>(std::move(future));
+}
+
+namespace co{
+
+/**
+ * *在scheduler上启动task，返回它结果的Future
+ * *Fiber中get()只让出当前协程，Task中可以co_await；丢弃返回值就是不关心结果
+ */
+template <class T>
+Future<T> spawn(Task<T> task, Scheduler *scheduler = Scheduler::GetThis()){
+    assert(scheduler && task.valid());
+    Promise<T> promise;
+    Future<T> future = promise.getFuture();
+    std::coroutine_handle<> h = co_detail::RunDetached(std::move(task), std::move(promise)).handle;
+    co_detail::ResumeOn(scheduler, h);
+    return future;
+}
+
+//*切换到scheduler上继续执行；在当前调度器上相当于让出
+inline co_detail::ScheduleAwaiter resumeOn(Scheduler *scheduler){
+    assert(scheduler);
+    return co_detail::ScheduleAwaiter(scheduler);
+}
+
+inline co_detail::ScheduleAwaiter yield() { return resumeOn(Scheduler::GetThis()); }
+
+//*挂起ms毫秒，需要在IOManager中调用
+inline co_detail::SleepAwaiter sleep(uint64_t ms) { return co_detail::SleepAwaiter(ms); }
+
+/**
+ * *以下都需要在IOManager中调用，fd为非阻塞，timeout_ms为~0ull表示不超时
+ * *返回值和errno同对应的系统调用，超时返回-1且errno为ETIMEDOUT
+ */
+inline co_detail::ReadAwaiter read(int fd, void *buf, size_t len, uint64_t timeout_ms = ~0ull){
+    return co_detail::ReadAwaiter(fd, buf, len, timeout_ms);
+}
+
+inline co_detail::WriteAwaiter write(int fd, const void *buf, size_t len, uint64_t timeout_ms = ~0ull){
+    return co_detail::WriteAwaiter(fd, buf, len, timeout_ms);
+}
+
+//*返回的fd已经是非阻塞的
+inline co_detail::AcceptAwaiter accept(int fd, sockaddr *addr = nullptr, socklen_t *addrlen = nullptr,
+                                       uint64_t timeout_ms = ~0ull){
+    return co_detail::AcceptAwaiter(fd, addr, addrlen, timeout_ms);
+}
+
+inline co_detail::ConnectAwaiter connect(int fd, const sockaddr *addr, socklen_t addrlen,
+                                         uint64_t timeout_ms = ~0ull){
+    return co_detail::ConnectAwaiter(fd, addr, addrlen, timeout_ms);
+}
+
+//*只等fd就绪不做IO，给自己调用系统调用的代码使用
+inline co_detail::ReadyAwaiter waitEvent(int fd, IOManager::Event event, uint64_t timeout_ms = ~0ull){
+    return co_detail::ReadyAwaiter(fd, event, timeout_ms);
+}
+
+}//co
+
+}//myconcurrent
+
+#endif
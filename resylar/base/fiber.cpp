@@ -1,7 +1,14 @@
 #pragma once
 #include <atomic>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
 #include "fiber.h"
+#include "stack_allocator.h"
+#include "stack_profile.h"
+#include "scheduler.h"
 #include "Logging.h"
+#include "CurrentThread.h"
 
 namespace myconcurrent
 {
@@ -20,14 +27,38 @@ static thread_local Fiber *t_fiber = nullptr;
 /// 线程局部变量，当前线程的主协程，切换到这个协程，就相当于切换到了主线程中运行，智能指针形式
 static thread_local Fiber::ptr t_thread_fiber = nullptr;
 
-//栈内存分配器
-class MallocStackAllocator{
-    public:
-        static void *Alloc(size_t size){return malloc(size);}
-        static void Dealloc(void *vp,size_t size){return free(vp);}
+//*默认栈大小，栈的物理页按需分配，这里只是地址空间
+static const size_t kDefaultStackSize = 1024 * 1024;
+
+//*共享栈的大小，每个线程一块，物理页按需分配
+static const size_t kSharedStackSize = 8 * 1024 * 1024;
+
+namespace{
+
+struct SharedStack{
+    void *stack = nullptr;
+    //*栈上现在是哪个协程的内容
+    Fiber *occupant = nullptr;
+    //*绑定在本线程、还没执行完的共享栈协程数
+    size_t bound = 0;
+
+    char *top() const { return static_cast<char *>(stack) + kSharedStackSize; }
+
+    ~SharedStack(){
+        if(stack)
+            StackAllocator::Dealloc(stack, kSharedStackSize);
+    }
 };
 
-using StackAllocator = MallocStackAllocator;
+}
+
+static thread_local SharedStack t_shared_stack;
+
+//*协程局部变量槽位的上限
+static const size_t kMaxLocalSlots = 256;
+//*各个槽位的析构函数，登记和协程结束时的读取可能在不同线程
+static std::atomic<void (*)(void *)> s_local_dtors[kMaxLocalSlots];
+static std::atomic<size_t> s_local_slots{0};
 
 uint64_t Fiber::GetFiberId(){
     if(t_fiber)
@@ -35,16 +66,14 @@ uint64_t Fiber::GetFiberId(){
     return 0;
 }
 
+uint64_t Fiber::TotalFibers(){
+    return s_fiber_count;
+}
+
 Fiber::Fiber(){
     SetThis(this);//
     m_state = RUNNING;
-
-    if(getcontext(&m_ctx)<0) 
-    {
-        LOG_INFO<<"getcontext error";
-        perror("getcontetx error:");
-        assert(false);
-    }
+    //*主协程的上下文在第一次切出时保存
     ++s_fiber_count;
     m_id = s_fiber_id++; //协程的id从0，开始
     LOG_DEBUG<<"Main Councurrent id :"<<m_id;
@@ -65,35 +94,44 @@ Fiber::ptr Fiber::GetThis(){
     return t_fiber->shared_from_this();//指向当前对象，获取当前对象
 }
 //带参的构造函数用于创建其他协程，需要分配栈
-Fiber::Fiber(std::function<void()> cb , size_t stacksize, bool run_in_scheduler)
+Fiber::Fiber(TaskFunc cb , size_t stacksize, bool run_in_scheduler, bool shared_stack, const char *tag)
     :m_id(s_fiber_id++),
-     m_cb(cb),
-     m_runInScheduler(run_in_scheduler)
+     m_cb(std::move(cb)),
+     m_runInScheduler(run_in_scheduler),
+     m_tag(tag)
 {
     ++s_fiber_count;//*增加协程的计数数量
-   m_stacksize = stacksize ? stacksize : 128*1024;//后者为默认大小
-   m_stack    = StackAllocator::Alloc(m_stacksize);
-   if(getcontext(&m_ctx)<0){
-    perror("getcontex");
-    assert(false);
-   }
-    m_ctx.uc_link = nullptr;
-    m_ctx.uc_stack.ss_sp   = m_stack;
-
-    m_ctx.uc_stack.ss_size = m_stacksize;
-
-    makecontext(&m_ctx, &Fiber::MainFunc, 0);
+#if defined(FIBER_ASM_CONTEXT)
+    m_shared = shared_stack;
+#else
+    //*ucontext拿不到切出时的栈指针，没法只拷贝用到的部分
+    if(shared_stack)
+        LOG_WARN<<"Fiber "<<m_id<<" shared stack needs the assembly context switch, use its own stack";
+#endif
+    if(m_shared){
+        //*上下文在第一次执行时建在所在线程的共享栈上
+        m_stacksize = kSharedStackSize;
+    }else{
+        m_stacksize = stacksize ? stacksize : StackSizeFor(tag);
+        m_stack    = StackAllocator::Alloc(m_stacksize);
+        maybePaintStack();
+        MakeContext(&m_ctx, m_stack, m_stacksize, &Fiber::MainFunc);
+    }
     LOG_DEBUG<<"Fiber::Fiber() id = " <<m_id;
 }
 
 Fiber::~Fiber(){
     LOG_DEBUG<<"Fiber::~Fiber() id = " <<m_id;
     --s_fiber_count;
+    clearLocals();
     //*存在栈空间属于子协程，需要确保已经是结束状态
     if(m_stack){
         assert(m_state == TERM);
         StackAllocator::Dealloc(m_stack,m_stacksize);
         LOG_DEBUG<<"StackAllocator::Dealloc() id = " <<m_id;
+    }else if(m_shared){
+        assert(m_state == TERM);
+        free(m_saved);
     }else{//*主协程
         assert(!m_cb); //*主协程没有回调
         //*而且一定要处于执行态
@@ -107,20 +145,193 @@ Fiber::~Fiber(){
 
 }
 
-void Fiber::reset(std::function<void()> cb){
-
+void Fiber::reset(TaskFunc cb, const char *tag){
+    //*只有结束态的子协程才能复用栈
+    assert(m_stack || m_shared);
+    assert(m_state == TERM);
+    clearLocals();
+    m_cb = std::move(cb);
+    m_tag = tag;
+    //*共享栈协程下次执行时重新绑定线程、建立上下文
+    if(!m_shared){
+        maybePaintStack();
+        MakeContext(&m_ctx, m_stack, m_stacksize, &Fiber::MainFunc);
+    }
+    m_state = READY;
 }
 
-void Fiber::resume(){
+Fiber::State Fiber::resume(){
+    assert(m_state != TERM && m_state != RUNNING);
+    if(m_shared)
+        switchInSharedStack();
+    SetThis(this);
+    m_state.store(RUNNING, std::memory_order_relaxed);
 
+    //*参与调度的协程和调度协程切换，否则和线程主协程切换
+    if(m_runInScheduler){
+        SwapContext(&(Scheduler::GetMainFiber()->m_ctx), &m_ctx);
+    }else{
+        SwapContext(&(t_thread_fiber->m_ctx), &m_ctx);
+    }
+    /**
+     * *回到这里时协程的上下文已经保存好了，这时才把状态改成READY
+     * *协程yield之前可能已经把自己交给了其他线程(比如等待队列)，其他线程看到READY之后才能resume它
+     */
+    if(m_state.load(std::memory_order_relaxed) == TERM){
+        if(m_shared)
+            releaseSharedStack();
+        if(m_profiled){
+            StackProfile::Record(m_tag, StackProfile::Measure(m_stack, m_stacksize), m_id);
+            m_profiled = false;
+        }
+        return TERM;
+    }
+    m_state.store(READY, std::memory_order_release);
+    return READY;
 }
 
 void Fiber::yield(){
+    //*协程运行完之后会自动yield一次，用于回到主协程，此时状态已为结束态
+    //*状态保持RUNNING，由resume的一方在切换回来之后改成READY
+    assert(m_state == RUNNING || m_state == TERM);
+
+    if(m_runInScheduler){
+        SetThis(Scheduler::GetMainFiber());
+        SwapContext(&m_ctx, &(Scheduler::GetMainFiber()->m_ctx));
+    }else{
+        SetThis(t_thread_fiber.get());
+        SwapContext(&m_ctx, &(t_thread_fiber->m_ctx));
+    }
+}
 
+bool Fiber::MaybeYield(){
+    if(!Scheduler::SliceExpired() || !Scheduler::InFiber())
+        return false;
+    Scheduler::GetThis()->yieldSlice();
+    return true;
 }
 
+size_t Fiber::AllocLocalSlot(void (*destroy)(void *)){
+    size_t idx = s_local_slots++;
+    if(idx >= kMaxLocalSlots){
+        LOG_ERROR<<"too many FiberLocal slots";
+        assert(false);
+    }
+    s_local_dtors[idx].store(destroy, std::memory_order_release);
+    return idx;
+}
+
+void *Fiber::PeekLocalSlot(size_t idx){
+    Fiber *cur = t_fiber;
+    if(!cur || idx >= cur->m_locals.size())
+        return nullptr;
+    return cur->m_locals[idx];
+}
+
+void *&Fiber::LocalSlot(size_t idx){
+    Fiber *cur = t_fiber;
+    if(!cur)
+        cur = GetThis().get();
+    if(idx >= cur->m_locals.size())
+        cur->m_locals.resize(idx + 1, nullptr);
+    return cur->m_locals[idx];
+}
+
+size_t Fiber::BoundSharedFibers(){
+    return t_shared_stack.bound;
+}
+
+size_t Fiber::StackSizeFor(const char *tag){
+    size_t size = StackProfile::SuggestSize(tag, kDefaultStackSize);
+    return size ? size : kDefaultStackSize;
+}
+
+void Fiber::maybePaintStack(){
+    m_profiled = StackProfile::ShouldSample();
+    if(m_profiled)
+        StackProfile::Paint(m_stack, m_stacksize);
+}
+
+void Fiber::switchInSharedStack(){
+#if defined(FIBER_ASM_CONTEXT)
+    SharedStack &shared = t_shared_stack;
+    if(!shared.stack)
+        shared.stack = StackAllocator::Alloc(kSharedStackSize);
+    if(m_boundThread != -1 && m_boundThread != CurrentThread::tid()){
+        LOG_ERROR<<"shared stack fiber "<<m_id<<" bound to thread "<<m_boundThread
+                 <<" resumed on thread "<<CurrentThread::tid();
+        assert(false);
+    }
+    Fiber *occupant = shared.occupant;
+    if(occupant == this)
+        return;
+    if(occupant){
+        //*共享栈协程里不能再resume别的共享栈协程，否则会覆盖自己正在用的栈
+        if(occupant->m_state.load(std::memory_order_relaxed) == RUNNING){
+            LOG_ERROR<<"shared stack fiber "<<m_id<<" resumed from shared stack fiber "<<occupant->m_id;
+            assert(false);
+        }
+        //*切出时的栈指针到栈顶就是实际用到的部分，缓冲区和它大小相当
+        char *sp = static_cast<char *>(occupant->m_ctx.sp);
+        size_t used = shared.top() - sp;
+        if(occupant->m_savedCap < used || occupant->m_savedCap > used * 2){
+            free(occupant->m_saved);
+            occupant->m_saved = static_cast<char *>(malloc(used));
+            occupant->m_savedCap = used;
+        }
+        memcpy(occupant->m_saved, sp, used);
+        occupant->m_savedSize = used;
+    }
+    shared.occupant = this;
+    if(m_boundThread == -1){
+        m_boundThread = CurrentThread::tid();
+        ++shared.bound;
+        MakeContext(&m_ctx, shared.stack, kSharedStackSize, &Fiber::MainFunc);
+    }else{
+        memcpy(shared.top() - m_savedSize, m_saved, m_savedSize);
+    }
+#endif
+}
+
+void Fiber::releaseSharedStack(){
+    SharedStack &shared = t_shared_stack;
+    if(shared.occupant == this)
+        shared.occupant = nullptr;
+    --shared.bound;
+    m_boundThread = -1;
+    m_savedSize = 0;
+}
+
+void Fiber::clearLocals(){
+    //*析构函数里可能又用到别的协程局部变量，直到全部清空为止
+    bool again = true;
+    while(again){
+        again = false;
+        for(size_t i = 0; i < m_locals.size(); ++i){
+            void *p = m_locals[i];
+            if(!p)
+                continue;
+            m_locals[i] = nullptr;
+            s_local_dtors[i].load(std::memory_order_acquire)(p);
+            again = true;
+        }
+    }
+}
+
+//*入口函数运行完之后会自动yield
 void Fiber::MainFunc(){
+    Fiber::ptr cur = GetThis(); //*GetThis()的shared_from_this()方法让引用计数加1
+    assert(cur);
+
+    cur->m_cb();
+    cur->m_cb    = nullptr;
+    //*协程局部变量的析构函数仍然在本协程中执行
+    cur->clearLocals();
+    cur->m_state = TERM;
 
+    auto raw_ptr = cur.get(); //*手动让t_fiber的引用计数减1
+    cur.reset();
+    raw_ptr->yield();
 }
 
 }// myconcurrent
@@ -1,9 +1,11 @@
 //协程类的实现
 #pragma once
-#include <functional>
+#include <atomic>
 #include <memory>
-#include <ucontext.h>
+#include <vector>
 #include "Thread.h"
+#include "fiber_context.h"
+#include "inplace_task.h"
 
 namespace myconcurrent{
 
@@ -27,13 +29,27 @@ class Fiber :  public std::enable_shared_from_this<Fiber>{//会获得一个成
         //用于创建第一个协程
         Fiber();
     public:
-        Fiber(std::function<void()> cb, size_t stacksize = 0, bool run_in_scheduler = true);
+        /**
+         * *shared_stack为true时使用共享栈：同一线程的共享栈协程轮流在一块每线程的大栈上运行，
+         * *被别的协程挤占时才把实际用到的部分拷到刚好大小的堆内存里，切回来时再拷回去，stacksize被忽略
+         * *共享栈协程第一次执行时绑定到当前线程，直到执行完都只在这个线程上运行；
+         * *不能把栈上对象的地址交给别人后让出，所以在其中做同步等待(FiberMutex、Future等)会阻塞线程而不是让出，
+         * *适合只等IO事件和定时器的大量空闲连接；需要汇编上下文切换，否则退回独立栈
+         * *tag是入口标签，必须是静态存储的字符串，栈用量按它汇总(StackProfile)；stacksize为0时按StackSizeFor(tag)选择
+         */
+        Fiber(TaskFunc cb, size_t stacksize = 0, bool run_in_scheduler = true, bool shared_stack = false,
+              const char *tag = nullptr);
+
+        ~Fiber();
+
         //重置，复用栈空间，减少malloc的使用
-        void reset(std::function<void()> cb);
+        void reset(TaskFunc cb, const char *tag = nullptr);
 
         //将当前协程切到执行状态
         //当前协程和正在运行的协程进行切换，前者变为RUNNING后者变为READY
-        void resume();
+        //返回切回来时协程的状态，TERM表示执行完了，READY表示中途让出；
+        //中途让出的协程可能已经被其他线程resume，之后不能再用getState()判断它是否在这里执行完
+        State resume();
 
         //当前协程让出执行权
         void yield();
@@ -42,7 +58,22 @@ class Fiber :  public std::enable_shared_from_this<Fiber>{//会获得一个成
         uint64_t getId() const {return m_id;}
 
         //获取协程状态
-        State getState() const { return m_state; }
+        State getState() const { return m_state.load(std::memory_order_acquire); }
+
+        //是否参与调度器调度
+        bool isRunInScheduler() const { return m_runInScheduler; }
+
+        //是否使用共享栈
+        bool isSharedStack() const { return m_shared; }
+
+        //共享栈协程绑定的线程id，没有绑定时为-1
+        int getBoundThread() const { return m_boundThread; }
+
+        //栈大小
+        size_t getStackSize() const { return m_stacksize; }
+
+        //入口标签
+        const char *getTag() const { return m_tag; }
 
     public:
         //设置正在运行协程，即设置线程局部变量t_fiber的值
@@ -60,6 +91,30 @@ class Fiber :  public std::enable_shared_from_this<Fiber>{//会获得一个成
 
        //获取当前协程的id
         static uint64_t GetFiberId();
+
+       /**
+        * *时间片检查点，长时间运行的循环里定期调用
+        * *看门狗发现当前协程已经用完时间片(Scheduler::setWatchdog)时，把自己重新加入调度并让出，返回true
+        * *没有用完或者不在调度器的协程中时只是一次读取，返回false
+        */
+        static bool MaybeYield();
+
+       /**
+        * *协程局部变量的槽位，供FiberLocal使用
+        * *AllocLocalSlot登记一个槽位和它的析构函数，槽位不回收，FiberLocal一般定义为全局或静态变量
+        * *LocalSlot返回当前协程(没有协程时是线程主协程)的槽位，协程结束、reset()或析构时依次调用析构函数
+        * *PeekLocalSlot只查不建：槽位还没分配或者当前线程没有协程时返回nullptr，不分配内存
+        */
+        static size_t AllocLocalSlot(void (*destroy)(void *));
+        static void *&LocalSlot(size_t idx);
+        static void *PeekLocalSlot(size_t idx);
+
+        //当前线程上绑定的、还没执行完的共享栈协程数
+        static size_t BoundSharedFibers();
+
+        //标签为tag的新协程的栈大小：开启自适应并且有足够样本时用统计结果，否则用默认大小
+        static size_t StackSizeFor(const char *tag);
+
        //协程入口函数
         static void MainFunc();
     private:
@@ -67,15 +122,41 @@ class Fiber :  public std::enable_shared_from_this<Fiber>{//会获得一个成
         uint64_t m_id = 0;
         //协程栈的大小
         uint32_t m_stacksize = 0;
-        //协程状态
-        State m_state = READY;
+        //协程状态，其他线程会读取，用来判断协程是否已经切出
+        std::atomic<State> m_state{READY};
 
-        ucontext_t m_ctx; //协程的上下文
+        FiberContext m_ctx; //协程的上下文
         //协程栈地址
         void *m_stack = nullptr;
         //协程入口函数
-        std::function<void()>m_cb;
+        TaskFunc m_cb;
         //本协程是否参与调度器调度
-        bool m_runInScheduler;
+        bool m_runInScheduler = false;
+        //协程局部变量，按槽位序号存放，用到时才扩展
+        std::vector<void *> m_locals;
+        //是否使用共享栈
+        bool m_shared = false;
+        //共享栈协程绑定的线程
+        int m_boundThread = -1;
+        //共享栈被挤占时保存的栈内容
+        char *m_saved = nullptr;
+        size_t m_savedSize = 0;
+        size_t m_savedCap = 0;
+        //入口标签
+        const char *m_tag = nullptr;
+        //栈已经涂过图案，执行完时统计用量
+        bool m_profiled = false;
+
+        //析构所有协程局部变量
+        void clearLocals();
+
+        //共享栈协程切入之前，把占着共享栈的协程的内容拷出去，再拷回自己的
+        void switchInSharedStack();
+
+        //共享栈协程执行完，解除和线程的绑定
+        void releaseSharedStack();
+
+        //按抽样决定是否涂栈，在建立上下文之前调用
+        void maybePaintStack();
     };
 }//myconcurrent
\ No newline at end of file
@@ -0,0 +1,145 @@
+#include "fiber_context.h"
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+
+namespace myconcurrent{
+
+#if defined(FIBER_ASM_CONTEXT)
+
+#if defined(__x86_64__)
+/**
+ * *rdi = &from->sp, rsi = to->sp
+ * *压栈顺序：rbp rbx r12~r15，再留8字节放MXCSR和x87控制字
+ */
+asm(R"(
+    .text
+    .globl myconcurrent_jump_context
+    .type myconcurrent_jump_context, @function
+    .align 16
+myconcurrent_jump_context:
+    pushq %rbp
+    pushq %rbx
+    pushq %r12
+    pushq %r13
+    pushq %r14
+    pushq %r15
+    subq $8, %rsp
+    stmxcsr (%rsp)
+    fnstcw 4(%rsp)
+    movq %rsp, (%rdi)
+    movq %rsi, %rsp
+    ldmxcsr (%rsp)
+    fldcw 4(%rsp)
+    addq $8, %rsp
+    popq %r15
+    popq %r14
+    popq %r13
+    popq %r12
+    popq %rbx
+    popq %rbp
+    ret
+    .size myconcurrent_jump_context, .-myconcurrent_jump_context
+    .section .note.GNU-stack,"",@progbits
+    .text
+)");
+
+//*切出时压栈的字节数：控制字8字节加6个寄存器
+static const size_t kSavedBytes = 8 + 6 * 8;
+
+void MakeContext(FiberContext *ctx, void *stack, size_t size, void (*entry)()){
+    uintptr_t top = ((uintptr_t)stack + size) & ~(uintptr_t)15;
+    uint64_t *sp = (uint64_t *)top;
+    //*假的返回地址，保证进入entry时和正常call之后一样，rsp+8是16字节对齐的
+    *--sp = 0;
+    //*第一次切换过来时ret到entry
+    *--sp = (uint64_t)(uintptr_t)entry;
+    sp = (uint64_t *)((char *)sp - kSavedBytes);
+    //*寄存器初值为0，MXCSR和x87控制字用默认值
+    for(size_t i = 1; i < kSavedBytes / 8; ++i)
+        sp[i] = 0;
+    uint32_t *csr = (uint32_t *)sp;
+    csr[0] = 0x1F80;
+    csr[1] = 0x037F;
+    ctx->sp = sp;
+}
+
+#elif defined(__aarch64__)
+/**
+ * *x0 = &from->sp, x1 = to->sp
+ * *保存x19~x30和d8~d15，共160字节
+ */
+asm(R"(
+    .text
+    .globl myconcurrent_jump_context
+    .type myconcurrent_jump_context, %function
+    .align 4
+myconcurrent_jump_context:
+    sub sp, sp, #160
+    stp x19, x20, [sp, #0]
+    stp x21, x22, [sp, #16]
+    stp x23, x24, [sp, #32]
+    stp x25, x26, [sp, #48]
+    stp x27, x28, [sp, #64]
+    stp x29, x30, [sp, #80]
+    stp d8, d9, [sp, #96]
+    stp d10, d11, [sp, #112]
+    stp d12, d13, [sp, #128]
+    stp d14, d15, [sp, #144]
+    mov x9, sp
+    str x9, [x0]
+    mov sp, x1
+    ldp x19, x20, [sp, #0]
+    ldp x21, x22, [sp, #16]
+    ldp x23, x24, [sp, #32]
+    ldp x25, x26, [sp, #48]
+    ldp x27, x28, [sp, #64]
+    ldp x29, x30, [sp, #80]
+    ldp d8, d9, [sp, #96]
+    ldp d10, d11, [sp, #112]
+    ldp d12, d13, [sp, #128]
+    ldp d14, d15, [sp, #144]
+    add sp, sp, #160
+    ret
+    .size myconcurrent_jump_context, .-myconcurrent_jump_context
+    .section .note.GNU-stack,"",%progbits
+    .text
+)");
+
+static const size_t kSavedBytes = 160;
+
+void MakeContext(FiberContext *ctx, void *stack, size_t size, void (*entry)()){
+    uintptr_t top = ((uintptr_t)stack + size) & ~(uintptr_t)15;
+    uint64_t *sp = (uint64_t *)(top - kSavedBytes);
+    for(size_t i = 0; i < kSavedBytes / 8; ++i)
+        sp[i] = 0;
+    //*x30(lr)：第一次切换过来时ret到entry，x29为0作为栈回溯的终点
+    sp[11] = (uint64_t)(uintptr_t)entry;
+    ctx->sp = sp;
+}
+
+#endif
+
+#else
+
+void MakeContext(FiberContext *ctx, void *stack, size_t size, void (*entry)()){
+    if(getcontext(&ctx->uc) < 0){
+        perror("getcontext");
+        assert(false);
+    }
+    ctx->uc.uc_link = nullptr;
+    ctx->uc.uc_stack.ss_sp = stack;
+    ctx->uc.uc_stack.ss_size = size;
+    makecontext(&ctx->uc, entry, 0);
+}
+
+void SwapContext(FiberContext *from, FiberContext *to){
+    if(swapcontext(&from->uc, &to->uc)){
+        perror("swapcontext");
+        assert(false);
+    }
+}
+
+#endif
+
+}//myconcurrent
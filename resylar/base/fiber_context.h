@@ -0,0 +1,44 @@
+#pragma once
+#include <stddef.h>
+
+/**
+ * *协程上下文切换
+ * *glibc的swapcontext每次切换都要调用rt_sigprocmask保存和恢复信号掩码，是一次系统调用
+ * *x86-64和aarch64上默认使用汇编实现，只保存被调用者保存的寄存器，切换就是换一次栈指针
+ * *编译时定义FIBER_UCONTEXT，或者在其他架构上，退回ucontext实现
+ * *汇编实现不切换信号掩码，协程中修改的信号掩码对同一线程上的其他协程同样生效
+ */
+#if !defined(FIBER_UCONTEXT) && (defined(__x86_64__) || defined(__aarch64__))
+#define FIBER_ASM_CONTEXT 1
+#else
+#include <ucontext.h>
+#endif
+
+namespace myconcurrent{
+
+#if defined(FIBER_ASM_CONTEXT)
+//*寄存器在切出时压在协程自己的栈上，上下文只是切出时的栈指针
+struct FiberContext{
+    void *sp = nullptr;
+};
+#else
+struct FiberContext{
+    ucontext_t uc;
+};
+#endif
+
+//*在[stack, stack+size)上准备一个从entry开始执行的上下文，entry不能返回
+void MakeContext(FiberContext *ctx, void *stack, size_t size, void (*entry)());
+
+//*把当前上下文保存到from，切换到to；之后切回from时从这里返回
+#if defined(FIBER_ASM_CONTEXT)
+extern "C" void myconcurrent_jump_context(void **from_sp, void *to_sp);
+
+inline void SwapContext(FiberContext *from, FiberContext *to){
+    myconcurrent_jump_context(&from->sp, to->sp);
+}
+#else
+void SwapContext(FiberContext *from, FiberContext *to);
+#endif
+
+}//myconcurrent
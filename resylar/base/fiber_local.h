@@ -0,0 +1,53 @@
+#pragma once
+#include "fiber.h"
+#include "noncopyable.h"
+
+namespace myconcurrent{
+
+/**
+ * *协程局部变量
+ * *thread_local在协程迁移到别的线程、或者同一个线程上的协程交替执行时都会串，请求级别的状态放在这里
+ * *每个协程一份，第一次访问时默认构造，协程结束或者reset()复用时析构；不在协程中访问时属于线程主协程
+ * *访问是一次线程局部变量读取加一次数组下标，可以用在日志、链路追踪这样的热路径上
+ *
+ * *static FiberLocal<RequestContext> t_ctx;
+ * *t_ctx->traceId = ...;
+ */
+template <class T>
+class FiberLocal : noncopyable{
+public:
+    FiberLocal() : m_index(Fiber::AllocLocalSlot(&Destroy)) {}
+
+    //*当前协程的值，没有则默认构造
+    T &get(){
+        if(void *p = Fiber::PeekLocalSlot(m_index))
+            return *static_cast<T *>(p);
+        void *&slot = Fiber::LocalSlot(m_index);
+        slot = new T();
+        return *static_cast<T *>(slot);
+    }
+
+    T &operator*() { return get(); }
+    T *operator->() { return &get(); }
+
+    //*当前协程是否已经构造过
+    bool has() const { return Fiber::PeekLocalSlot(m_index) != nullptr; }
+
+    //*提前析构当前协程的值，下次访问时重新构造
+    void reset(){
+        if(!Fiber::PeekLocalSlot(m_index))
+            return;
+        void *&slot = Fiber::LocalSlot(m_index);
+        void *p = slot;
+        slot = nullptr;
+        Destroy(p);
+    }
+
+private:
+    static void Destroy(void *p) { delete static_cast<T *>(p); }
+
+private:
+    const size_t m_index;
+};
+
+}//myconcurrent
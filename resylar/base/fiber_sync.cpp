@@ -0,0 +1,193 @@
+#include "fiber_sync.h"
+#include "Condition.h"
+#include "scheduler.h"
+
+namespace myconcurrent{
+
+/**
+ * *等待者放在等待方自己的栈上，唤醒之前一直有效
+ */
+struct FiberWaitQueue::Waiter{
+    Waiter *next = nullptr;
+    //*在协程中等待
+    Fiber::ptr fiber;
+    Scheduler *scheduler = nullptr;
+    //*在线程中等待
+    MutexLock mutex;
+    Condition cond;
+    bool woken = false;
+
+    Waiter() : cond(mutex) {}
+};
+
+void FiberWaitQueue::waitLocked(){
+    Waiter w;
+    Fiber *cur = nullptr;
+    if(Scheduler::InFiber()){
+        w.fiber = Fiber::GetThis();
+        w.scheduler = Scheduler::GetThis();
+        cur = w.fiber.get();
+    }
+    if(m_tail)
+        m_tail->next = &w;
+    else
+        m_head = &w;
+    m_tail = &w;
+    m_mutex.unlock();
+
+    //*解锁之后w.fiber随时可能被Wake()取走，只能用之前取出的裸指针
+    if(cur){
+        //*Wake()把协程重新加入调度，还没切出去就被取到时调度器会把它放回队尾
+        cur->yield();
+    }else{
+        MutexLockGuard lock(w.mutex);
+        while(!w.woken)
+            w.cond.wait();
+    }
+}
+
+FiberWaitQueue::Waiter *FiberWaitQueue::popLocked(){
+    Waiter *w = m_head;
+    if(w){
+        m_head = w->next;
+        if(!m_head)
+            m_tail = nullptr;
+        w->next = nullptr;
+    }
+    return w;
+}
+
+FiberWaitQueue::Waiter *FiberWaitQueue::takeAllLocked(){
+    Waiter *w = m_head;
+    m_head = m_tail = nullptr;
+    return w;
+}
+
+FiberWaitQueue::Waiter *FiberWaitQueue::Next(Waiter *w){
+    return w->next;
+}
+
+void FiberWaitQueue::Wake(Waiter *w){
+    if(w->fiber){
+        Scheduler *scheduler = w->scheduler;
+        Fiber::ptr fiber = std::move(w->fiber);
+        scheduler->schedule(std::move(fiber));
+    }else{
+        MutexLockGuard lock(w->mutex);
+        w->woken = true;
+        w->cond.notify();
+    }
+}
+
+void FiberMutex::lockSlow(){
+    while(true){
+        m_waiters.lock();
+        //*标记为有等待者，原来是0说明锁已经释放，直接拿到
+        if(m_state.exchange(2, std::memory_order_acquire) == 0){
+            m_waiters.unlock();
+            return;
+        }
+        m_waiters.waitLocked();
+        //*被唤醒后重新竞争，仍然按有等待者处理，保证释放时会唤醒后面的等待者
+    }
+}
+
+void FiberMutex::unlockSlow(){
+    m_waiters.lock();
+    m_state.store(0, std::memory_order_release);
+    FiberWaitQueue::Waiter *w = m_waiters.popLocked();
+    m_waiters.unlock();
+    if(w)
+        FiberWaitQueue::Wake(w);
+}
+
+void FiberCondition::wait(){
+    m_waiters.lock();
+    m_waiterCount.fetch_add(1, std::memory_order_relaxed);
+    //*先进入等待队列再释放mutex，notify必须拿到队列的锁才能取等待者，不会丢失通知
+    m_mutex.unlock();
+    m_waiters.waitLocked();
+    m_mutex.lock();
+}
+
+void FiberCondition::notify(){
+    if(m_waiterCount.load(std::memory_order_acquire) == 0)
+        return;
+    m_waiters.lock();
+    FiberWaitQueue::Waiter *w = m_waiters.popLocked();
+    if(w)
+        m_waiterCount.fetch_sub(1, std::memory_order_relaxed);
+    m_waiters.unlock();
+    if(w)
+        FiberWaitQueue::Wake(w);
+}
+
+void FiberCondition::notifyAll(){
+    if(m_waiterCount.load(std::memory_order_acquire) == 0)
+        return;
+    m_waiters.lock();
+    FiberWaitQueue::Waiter *w = m_waiters.takeAllLocked();
+    m_waiterCount.store(0, std::memory_order_relaxed);
+    m_waiters.unlock();
+    while(w){
+        FiberWaitQueue::Waiter *next = FiberWaitQueue::Next(w);
+        FiberWaitQueue::Wake(w);
+        w = next;
+    }
+}
+
+bool FiberSemaphore::tryWait(){
+    int64_t count = m_count.load(std::memory_order_relaxed);
+    while(count > 0){
+        if(m_count.compare_exchange_weak(count, count - 1, std::memory_order_acquire, std::memory_order_relaxed))
+            return true;
+    }
+    return false;
+}
+
+void FiberSemaphore::waitSlow(){
+    m_waiters.lock();
+    //*post已经先到了，直接拿走留下的唤醒
+    if(m_wakeups > 0){
+        --m_wakeups;
+        m_waiters.unlock();
+        return;
+    }
+    m_waiters.waitLocked();
+}
+
+void FiberSemaphore::postSlow(){
+    m_waiters.lock();
+    FiberWaitQueue::Waiter *w = m_waiters.popLocked();
+    if(!w)
+        ++m_wakeups;
+    m_waiters.unlock();
+    if(w)
+        FiberWaitQueue::Wake(w);
+}
+
+void FiberCountDownLatch::wait(){
+    if(m_count.load(std::memory_order_acquire) <= 0)
+        return;
+    m_waiters.lock();
+    if(m_count.load(std::memory_order_acquire) <= 0){
+        m_waiters.unlock();
+        return;
+    }
+    m_waiters.waitLocked();
+}
+
+void FiberCountDownLatch::countDown(){
+    if(m_count.fetch_sub(1, std::memory_order_acq_rel) != 1)
+        return;
+    m_waiters.lock();
+    FiberWaitQueue::Waiter *w = m_waiters.takeAllLocked();
+    m_waiters.unlock();
+    while(w){
+        FiberWaitQueue::Waiter *next = FiberWaitQueue::Next(w);
+        FiberWaitQueue::Wake(w);
+        w = next;
+    }
+}
+
+}//myconcurrent
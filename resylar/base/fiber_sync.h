@@ -0,0 +1,162 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include "MutexLock.h"
+#include "noncopyable.h"
+
+/**
+ * *协程同步原语
+ * *MutexLock、Condition、CountDownLatch阻塞的是整个工作线程，排在这个线程上的其他协程也跟着停下
+ * *这里的原语在协程中等待时只挂起当前协程，释放时通过Scheduler::schedule重新加入调度；
+ * *不在调度器协程中(比如普通线程)调用时退化为阻塞线程
+ * *没有竞争时只有一次原子操作，不加锁
+ */
+namespace myconcurrent{
+
+/**
+ * *等待队列，下面几个原语的慢路径
+ * *先lock()，检查条件后调用waitLocked()挂起；唤醒方在锁内取出等待者，解锁后再wake()
+ */
+class FiberWaitQueue : noncopyable{
+public:
+    struct Waiter;
+
+    void lock() { m_mutex.lock(); }
+    void unlock() { m_mutex.unlock(); }
+
+    //*调用前必须持有锁；把当前协程(或线程)加入队尾，释放锁后挂起，被唤醒后返回，返回时不持有锁
+    void waitLocked();
+
+    //*调用前必须持有锁；取出队头的等待者，队列为空返回nullptr
+    Waiter *popLocked();
+
+    //*调用前必须持有锁；取出全部等待者，用Next()遍历
+    Waiter *takeAllLocked();
+
+    //*链表中的下一个等待者，必须在wake()之前读取
+    static Waiter *Next(Waiter *w);
+
+    //*唤醒等待者，不需要持有锁；唤醒之后不能再访问w
+    static void Wake(Waiter *w);
+
+private:
+    MutexLock m_mutex;
+    Waiter *m_head = nullptr;
+    Waiter *m_tail = nullptr;
+};
+
+/**
+ * *协程互斥锁
+ */
+class FiberMutex : noncopyable{
+public:
+    void lock(){
+        int expected = 0;
+        if(!m_state.compare_exchange_strong(expected, 1, std::memory_order_acquire, std::memory_order_relaxed))
+            lockSlow();
+    }
+
+    bool tryLock(){
+        int expected = 0;
+        return m_state.compare_exchange_strong(expected, 1, std::memory_order_acquire, std::memory_order_relaxed);
+    }
+
+    void unlock(){
+        if(m_state.fetch_sub(1, std::memory_order_release) != 1)
+            unlockSlow();
+    }
+
+private:
+    void lockSlow();
+    void unlockSlow();
+
+private:
+    //*0未加锁，1加锁且没有等待者，2加锁且可能有等待者
+    std::atomic<int> m_state = {0};
+    FiberWaitQueue m_waiters;
+};
+
+class FiberMutexGuard : noncopyable{
+public:
+    explicit FiberMutexGuard(FiberMutex &mutex) : m_mutex(mutex) { m_mutex.lock(); }
+    ~FiberMutexGuard() { m_mutex.unlock(); }
+
+private:
+    FiberMutex &m_mutex;
+};
+
+/**
+ * *协程条件变量，配合FiberMutex使用
+ */
+class FiberCondition : noncopyable{
+public:
+    explicit FiberCondition(FiberMutex &mutex) : m_mutex(mutex) {}
+
+    //*调用前必须持有mutex，返回时重新持有
+    void wait();
+    void notify();
+    void notifyAll();
+
+private:
+    FiberMutex &m_mutex;
+    //*等待者数量，没有等待者时notify不加锁
+    std::atomic<size_t> m_waiterCount = {0};
+    FiberWaitQueue m_waiters;
+};
+
+/**
+ * *协程信号量
+ */
+class FiberSemaphore : noncopyable{
+public:
+    explicit FiberSemaphore(int64_t count = 0) : m_count(count) {}
+
+    void wait(){
+        if(m_count.fetch_sub(1, std::memory_order_acquire) > 0)
+            return;
+        waitSlow();
+    }
+
+    bool tryWait();
+
+    void post(){
+        if(m_count.fetch_add(1, std::memory_order_release) >= 0)
+            return;
+        postSlow();
+    }
+
+    //*当前可用的数量
+    int64_t getCount() const{
+        int64_t count = m_count.load(std::memory_order_relaxed);
+        return count > 0 ? count : 0;
+    }
+
+private:
+    void waitSlow();
+    void postSlow();
+
+private:
+    //*小于0时绝对值是等待者数量(包括正在进入等待队列的)
+    std::atomic<int64_t> m_count;
+    //*post时等待者还没来得及入队，留给它的唤醒次数，m_waiters的锁保护
+    int64_t m_wakeups = 0;
+    FiberWaitQueue m_waiters;
+};
+
+/**
+ * *协程版的CountDownLatch
+ */
+class FiberCountDownLatch : noncopyable{
+public:
+    explicit FiberCountDownLatch(int count) : m_count(count) {}
+
+    void wait();
+    void countDown();
+    int getCount() const { return m_count.load(std::memory_order_acquire); }
+
+private:
+    std::atomic<int> m_count;
+    FiberWaitQueue m_waiters;
+};
+
+}//myconcurrent
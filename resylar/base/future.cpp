@@ -0,0 +1,138 @@
+#include "future.h"
+#include "Condition.h"
+
+namespace myconcurrent{
+
+namespace{
+
+/**
+ * *等待者放在等待方自己的栈上，唤醒之前一直有效
+ */
+struct Waiter : FutureStateBase::Continuation{
+    //*在协程中等待
+    Fiber::ptr fiber;
+    Scheduler *scheduler = nullptr;
+    //*在线程中等待
+    MutexLock mutex;
+    Condition cond;
+    bool woken = false;
+
+    Waiter() : cond(mutex) {}
+
+    static void Wake(FutureStateBase::Continuation *c){
+        Waiter *w = static_cast<Waiter *>(c);
+        if(w->fiber){
+            //*加入调度之后等待者随时可能返回，不能再访问w
+            Scheduler *scheduler = w->scheduler;
+            Fiber::ptr fiber = std::move(w->fiber);
+            scheduler->schedule(std::move(fiber));
+        }else{
+            MutexLockGuard lock(w->mutex);
+            w->woken = true;
+            w->cond.notify();
+        }
+    }
+};
+
+}//namespace
+
+bool FutureStateBase::subscribe(Continuation *c){
+    Continuation *head = m_head.load(std::memory_order_acquire);
+    do{
+        if(head == Ready())
+            return false;
+        c->next = head;
+    }while(!m_head.compare_exchange_weak(head, c, std::memory_order_acq_rel, std::memory_order_acquire));
+    return true;
+}
+
+void FutureStateBase::wait(){
+    if(isReady())
+        return;
+    Waiter w;
+    w.run = &Waiter::Wake;
+    Fiber *cur = nullptr;
+    if(Scheduler::InFiber()){
+        w.fiber = Fiber::GetThis();
+        w.scheduler = Scheduler::GetThis();
+        cur = w.fiber.get();
+    }
+    if(!subscribe(&w))
+        return;
+    if(cur){
+        //*完成方把协程重新加入调度，还没切出去就被取到时调度器会把它放回队尾
+        cur->yield();
+    }else{
+        MutexLockGuard lock(w.mutex);
+        while(!w.woken)
+            w.cond.wait();
+    }
+}
+
+void FutureStateBase::complete(){
+    Continuation *c = m_head.exchange(Ready(), std::memory_order_acq_rel);
+    //*链表是后注册的在前，反转后按注册顺序执行
+    Continuation *ordered = nullptr;
+    while(c){
+        Continuation *next = c->next;
+        c->next = ordered;
+        ordered = c;
+        c = next;
+    }
+    while(ordered){
+        //*回调之后节点可能已经失效，先取出下一个
+        Continuation *next = ordered->next;
+        ordered->run(ordered);
+        ordered = next;
+    }
+}
+
+void FutureStateBase::resetBase(){
+    error = nullptr;
+    pending.store(0, std::memory_order_relaxed);
+    combine.result = nullptr;
+    combine.index = 0;
+    then.owner = nullptr;
+    thenTask = nullptr;
+    thenScheduler = nullptr;
+    m_refs.store(1, std::memory_order_relaxed);
+    m_head.store(nullptr, std::memory_order_relaxed);
+}
+
+void FutureStateBase::RunThen(Continuation *c){
+    FutureStateBase *owner = static_cast<ThenNode *>(c)->owner;
+    //*thenTask持有这个Future，取出之后共享状态的生命周期由任务负责
+    TaskFunc task = std::move(owner->thenTask);
+    Scheduler *scheduler = owner->thenScheduler;
+    if(scheduler)
+        scheduler->schedule(std::move(task));
+    else
+        task();
+}
+
+namespace future_detail{
+
+void OnAllReady(FutureStateBase::Continuation *c){
+    FutureStateBase::CombineNode *node = static_cast<FutureStateBase::CombineNode *>(c);
+    FutureState<void> *result = static_cast<FutureState<void> *>(node->result);
+    node->result = nullptr;
+    if(result->pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        result->complete();
+    FutureState<void>::Release(result);
+}
+
+void OnAnyReady(FutureStateBase::Continuation *c){
+    FutureStateBase::CombineNode *node = static_cast<FutureStateBase::CombineNode *>(c);
+    FutureState<size_t> *result = static_cast<FutureState<size_t> *>(node->result);
+    size_t index = node->index;
+    node->result = nullptr;
+    if(result->pending.exchange(0, std::memory_order_acq_rel) == 1){
+        result->value.set(index);
+        result->complete();
+    }
+    FutureState<size_t>::Release(result);
+}
+
+}//future_detail
+
+}//myconcurrent
@@ -0,0 +1,483 @@
+#pragma once
+#include <assert.h>
+#include <atomic>
+#include <exception>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "inplace_task.h"
+#include "noncopyable.h"
+#include "scheduler.h"
+
+/**
+ * *Future/Promise
+ * *Scheduler::async(fn)返回Future，get()在调度器的协程中只让出当前协程，在其他线程中阻塞等待
+ * *whenAll/whenAny组合多个Future，then()在结果就绪后把后续处理交给调度器
+ * *共享状态从每个线程的空闲链表中分配，async的回调放得进TaskFunc时，一次分发-汇总不分配内存
+ */
+namespace myconcurrent{
+
+template <class T> class Future;
+template <class T> class Promise;
+
+/**
+ * *共享状态中和结果类型无关的部分：引用计数、完成回调链表和等待
+ */
+class FutureStateBase : noncopyable{
+public:
+    //*完成回调，节点由注册方提供(等待者的栈上或者共享状态里)，不分配内存
+    struct Continuation{
+        Continuation *next = nullptr;
+        void (*run)(Continuation *self) = nullptr;
+    };
+
+    //*注册完成回调；已经完成时返回false，不会再回调
+    bool subscribe(Continuation *c);
+
+    bool isReady() const { return m_head.load(std::memory_order_acquire) == Ready(); }
+
+    //*等待完成，在调度器的协程中只让出当前协程
+    void wait();
+
+    //*结果写好之后调用，按注册顺序执行回调
+    void complete();
+
+    void addRef() { m_refs.fetch_add(1, std::memory_order_relaxed); }
+
+    //*返回true表示释放的是最后一个引用
+    bool releaseRef() { return m_refs.fetch_sub(1, std::memory_order_acq_rel) == 1; }
+
+    //*放回池中之前重置
+    void resetBase();
+
+    //*then()的回调：把thenTask交给thenScheduler，没有调度器时直接执行
+    static void RunThen(Continuation *c);
+
+public:
+    std::exception_ptr error;
+
+    //*whenAll/whenAny作为结果时的计数
+    std::atomic<size_t> pending = {0};
+
+    //*whenAll/whenAny作为输入时挂在自己回调链表上的节点，同一时间只能参与一个组合
+    struct CombineNode : Continuation{
+        FutureStateBase *result = nullptr;
+        size_t index = 0;
+    } combine;
+
+    //*then()的节点和后续任务，Future只能then一次
+    struct ThenNode : Continuation{
+        FutureStateBase *owner = nullptr;
+    } then;
+    TaskFunc thenTask;
+    Scheduler *thenScheduler = nullptr;
+
+protected:
+    FutureStateBase() {}
+
+private:
+    static Continuation *Ready() { return reinterpret_cast<Continuation *>(1); }
+
+private:
+    std::atomic<int> m_refs = {1};
+    //*回调链表，完成后为Ready()
+    std::atomic<Continuation *> m_head = {nullptr};
+};
+
+template <class T>
+struct FutureValue{
+    typename std::aligned_storage<sizeof(T), alignof(T)>::type buf;
+    bool has = false;
+
+    template <class U>
+    void set(U &&v){
+        new (&buf) T(std::forward<U>(v));
+        has = true;
+    }
+    T &get() { return *reinterpret_cast<T *>(&buf); }
+    void destroy(){
+        if(has){
+            get().~T();
+            has = false;
+        }
+    }
+};
+
+template <>
+struct FutureValue<void>{
+    void set() {}
+    void destroy() {}
+};
+
+/**
+ * *共享状态，按结果类型各有一个每线程的空闲链表
+ */
+template <class T>
+class FutureState : public FutureStateBase{
+public:
+    static FutureState *Create(){
+        std::vector<FutureState *> &pool = Pool().free;
+        if(pool.empty())
+            return new FutureState;
+        FutureState *s = pool.back();
+        pool.pop_back();
+        return s;
+    }
+
+    static void Release(FutureState *s){
+        if(!s->releaseRef())
+            return;
+        s->value.destroy();
+        s->resetBase();
+        std::vector<FutureState *> &pool = Pool().free;
+        if(pool.size() < kPoolSize)
+            pool.push_back(s);
+        else
+            delete s;
+    }
+
+    FutureValue<T> value;
+
+private:
+    //*每个线程最多缓存的共享状态数
+    static const size_t kPoolSize = 1024;
+
+    struct PoolList{
+        std::vector<FutureState *> free;
+        ~PoolList(){
+            for(auto s : free)
+                delete s;
+        }
+    };
+
+    static PoolList &Pool(){
+        static thread_local PoolList pool;
+        return pool;
+    }
+};
+
+namespace future_detail{
+
+//*调用fn并把结果写入promise
+template <class R>
+struct Setter{
+    template <class Fn, class... Args>
+    static void Call(Promise<R> &promise, Fn &fn, Args &&...args){
+        promise.setValue(fn(std::forward<Args>(args)...));
+    }
+};
+
+template <>
+struct Setter<void>{
+    //*Promise<void>在这里还不完整，参数类型做成模板推迟到实例化时
+    template <class P, class Fn, class... Args>
+    static void Call(P &promise, Fn &fn, Args &&...args){
+        fn(std::forward<Args>(args)...);
+        promise.setValue();
+    }
+};
+
+//*取出上一步的结果调用fn
+template <class T>
+struct Chain{
+    template <class R, class Fn>
+    static void Call(Future<T> &source, Fn &fn, Promise<R> &promise){
+        Setter<R>::Call(promise, fn, source.get());
+    }
+};
+
+template <>
+struct Chain<void>{
+    template <class R, class Fn, class F>
+    static void Call(F &source, Fn &fn, Promise<R> &promise){
+        source.get();
+        Setter<R>::Call(promise, fn);
+    }
+};
+
+template <class T, class Fn>
+struct ThenResult{
+    typedef typename std::decay<decltype(std::declval<Fn &>()(std::declval<T>()))>::type type;
+};
+
+template <class Fn>
+struct ThenResult<void, Fn>{
+    typedef typename std::decay<decltype(std::declval<Fn &>()())>::type type;
+};
+
+//*then()的后续任务
+template <class T, class Fn, class R>
+struct ThenTask{
+    Future<T> source;
+    Fn fn;
+    Promise<R> promise;
+
+    void operator()(){
+        try{
+            Chain<T>::Call(source, fn, promise);
+        }catch(...){
+            promise.setException(std::current_exception());
+        }
+    }
+};
+
+//*Scheduler::async()的任务
+template <class Fn, class R>
+struct AsyncTask{
+    Fn fn;
+    Promise<R> promise;
+
+    void operator()(){
+        try{
+            Setter<R>::Call(promise, fn);
+        }catch(...){
+            promise.setException(std::current_exception());
+        }
+    }
+};
+
+//*whenAll/whenAny的输入完成时的回调
+void OnAllReady(FutureStateBase::Continuation *c);
+void OnAnyReady(FutureStateBase::Continuation *c);
+
+}//future_detail
+
+/**
+ * *结果的写入端，只能设置一次；没有设置就析构时，Future得到一个异常
+ */
+template <class T>
+class Promise{
+public:
+    Promise() : m_state(FutureState<T>::Create()) {}
+
+    Promise(Promise &&other) noexcept
+        :m_state(other.m_state),
+         m_retrieved(other.m_retrieved),
+         m_set(other.m_set)
+    {
+        other.m_state = nullptr;
+    }
+
+    Promise &operator=(Promise &&other) noexcept{
+        if(this != &other){
+            Promise tmp(std::move(other));
+            std::swap(m_state, tmp.m_state);
+            std::swap(m_retrieved, tmp.m_retrieved);
+            std::swap(m_set, tmp.m_set);
+        }
+        return *this;
+    }
+
+    Promise(const Promise &) = delete;
+    Promise &operator=(const Promise &) = delete;
+
+    ~Promise(){
+        if(!m_state)
+            return;
+        if(!m_set)
+            setException(std::make_exception_ptr(std::runtime_error("broken promise")));
+        FutureState<T>::Release(m_state);
+    }
+
+    //*只能取一次
+    Future<T> getFuture(){
+        assert(m_state && !m_retrieved);
+        m_retrieved = true;
+        m_state->addRef();
+        return Future<T>(m_state);
+    }
+
+    template <class... U>
+    void setValue(U &&...v){
+        assert(m_state && !m_set);
+        m_set = true;
+        m_state->value.set(std::forward<U>(v)...);
+        m_state->complete();
+    }
+
+    void setException(std::exception_ptr e){
+        assert(m_state && !m_set);
+        m_set = true;
+        m_state->error = e;
+        m_state->complete();
+    }
+
+private:
+    FutureState<T> *m_state;
+    bool m_retrieved = false;
+    bool m_set = false;
+};
+
+/**
+ * *结果的读取端，只能移动；get()取走结果后失效
+ */
+template <class T>
+class Future{
+public:
+    Future() : m_state(nullptr) {}
+    explicit Future(FutureState<T> *state) : m_state(state) {}
+
+    Future(Future &&other) noexcept : m_state(other.m_state) { other.m_state = nullptr; }
+
+    Future &operator=(Future &&other) noexcept{
+        if(this != &other){
+            reset();
+            m_state = other.m_state;
+            other.m_state = nullptr;
+        }
+        return *this;
+    }
+
+    Future(const Future &) = delete;
+    Future &operator=(const Future &) = delete;
+
+    ~Future() { reset(); }
+
+    bool valid() const { return m_state != nullptr; }
+
+    bool isReady() const { return m_state && m_state->isReady(); }
+
+    //*等待结果就绪，在调度器的协程中只让出当前协程
+    void wait() const{
+        assert(m_state);
+        m_state->wait();
+    }
+
+    //*等待并取走结果，之后valid()为false
+    T get(){
+        assert(m_state);
+        m_state->wait();
+        Holder holder(m_state);
+        m_state = nullptr;
+        if(holder.state->error)
+            std::rethrow_exception(holder.state->error);
+        return Take(holder.state, std::is_void<T>());
+    }
+
+    //*注册完成回调，节点由调用方保证在回调之前一直有效；已经就绪时返回false，不会再回调
+    bool subscribe(FutureStateBase::Continuation *c){
+        assert(m_state);
+        return m_state->subscribe(c);
+    }
+
+    /**
+     * *结果就绪后在scheduler上执行fn(结果)，void的Future执行fn()，返回fn结果的Future
+     * *scheduler为空时在设置结果的线程里直接执行；这个Future被移走，之后valid()为false
+     * *上一步的异常直接传给返回的Future，不调用fn
+     */
+    template <class Fn>
+    Future<typename future_detail::ThenResult<T, typename std::decay<Fn>::type>::type>
+    then(Fn &&fn, Scheduler *scheduler = Scheduler::GetThis()){
+        typedef typename std::decay<Fn>::type F;
+        typedef typename future_detail::ThenResult<T, F>::type R;
+        assert(m_state);
+        FutureState<T> *state = m_state;
+        Promise<R> promise;
+        Future<R> result = promise.getFuture();
+        state->thenScheduler = scheduler;
+        state->thenTask = future_detail::ThenTask<T, F, R>{std::move(*this), std::forward<Fn>(fn), std::move(promise)};
+        state->then.owner = state;
+        state->then.run = &FutureStateBase::RunThen;
+        if(!state->subscribe(&state->then))
+            FutureStateBase::RunThen(&state->then);
+        return result;
+    }
+
+private:
+    template <class It>
+    friend Future<void> whenAll(It begin, It end);
+    template <class It>
+    friend Future<size_t> whenAny(It begin, It end);
+
+    //*get()中保证异常时也释放共享状态
+    struct Holder{
+        FutureState<T> *state;
+        explicit Holder(FutureState<T> *s) : state(s) {}
+        ~Holder() { FutureState<T>::Release(state); }
+    };
+
+    template <class U = T>
+    static U Take(FutureState<U> *state, std::false_type) { return std::move(state->value.get()); }
+    static void Take(FutureState<T> *, std::true_type) {}
+
+    void reset(){
+        if(m_state){
+            FutureState<T>::Release(m_state);
+            m_state = nullptr;
+        }
+    }
+
+private:
+    FutureState<T> *m_state;
+};
+
+/**
+ * *[begin, end)中的Future全部就绪后就绪，输入的Future保持有效，之后逐个get()不会再等待
+ * *输入出错不影响组合结果，在各自get()时抛出
+ */
+template <class It>
+Future<void> whenAll(It begin, It end){
+    FutureState<void> *result = FutureState<void>::Create();
+    //*多出来的1在注册完所有输入后减掉，避免注册过程中就完成
+    result->pending.store(1, std::memory_order_relaxed);
+    for(It it = begin; it != end; ++it){
+        FutureStateBase *input = it->m_state;
+        assert(input && !input->combine.result);
+        result->pending.fetch_add(1, std::memory_order_relaxed);
+        result->addRef();
+        input->combine.result = result;
+        input->combine.run = &future_detail::OnAllReady;
+        if(!input->subscribe(&input->combine))
+            future_detail::OnAllReady(&input->combine);
+    }
+    if(result->pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        result->complete();
+    return Future<void>(result);
+}
+
+template <class T>
+Future<void> whenAll(std::vector<Future<T>> &futures){
+    return whenAll(futures.begin(), futures.end());
+}
+
+/**
+ * *[begin, end)中任意一个Future就绪后就绪，结果是它的序号；输入的Future保持有效
+ */
+template <class It>
+Future<size_t> whenAny(It begin, It end){
+    assert(begin != end);
+    FutureState<size_t> *result = FutureState<size_t>::Create();
+    //*1表示还没有输入就绪，第一个把它换成0的输入写入结果
+    result->pending.store(1, std::memory_order_relaxed);
+    size_t index = 0;
+    for(It it = begin; it != end; ++it, ++index){
+        FutureStateBase *input = it->m_state;
+        assert(input && !input->combine.result);
+        result->addRef();
+        input->combine.result = result;
+        input->combine.index = index;
+        input->combine.run = &future_detail::OnAnyReady;
+        if(!input->subscribe(&input->combine))
+            future_detail::OnAnyReady(&input->combine);
+    }
+    return Future<size_t>(result);
+}
+
+template <class T>
+Future<size_t> whenAny(std::vector<Future<T>> &futures){
+    return whenAny(futures.begin(), futures.end());
+}
+
+template <class Fn>
+Future<typename std::decay<decltype(std::declval<Fn &>()())>::type>
+Scheduler::async(Fn &&fn, Priority priority){
+    typedef typename std::decay<Fn>::type F;
+    typedef typename std::decay<decltype(std::declval<Fn &>()())>::type R;
+    Promise<R> promise;
+    Future<R> future = promise.getFuture();
+    schedule(future_detail::AsyncTask<F, R>{std::forward<Fn>(fn), std::move(promise)}, -1, priority);
+    return future;
+}
+
+}//myconcurrent
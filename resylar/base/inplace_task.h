@@ -0,0 +1,161 @@
+#pragma once
+#include <cstddef>
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace myconcurrent{
+
+/**
+ * *只能移动、自带小缓冲区的void()可调用对象，用来替代调度路径上的std::function<void()>
+ * *大小不超过N字节、移动构造不抛异常的可调用对象直接放在对象内部，不分配堆内存；
+ * *放不下的才退化成在堆上分配，行为和std::function一致
+ * *因为不要求可拷贝，调度、定时器、IO事件之间传递回调都用移动，不会再复制捕获的状态
+ */
+template <size_t N>
+class InplaceTask{
+public:
+    InplaceTask() {}
+    InplaceTask(std::nullptr_t) {}
+
+    //*任何可以用()调用的对象，空的函数指针或std::function构造出空任务
+    template <class F,
+              class Fn = typename std::decay<F>::type,
+              class = typename std::enable_if<!std::is_same<Fn, InplaceTask>::value>::type,
+              class = decltype(std::declval<Fn &>()())>
+    InplaceTask(F &&f){
+        if(NullCheck<Fn>::IsNull(f))
+            return;
+        Construct<Fn>(std::forward<F>(f), std::integral_constant<bool, Fits<Fn>::value>());
+    }
+
+    InplaceTask(InplaceTask &&other) noexcept{
+        moveFrom(other);
+    }
+
+    InplaceTask &operator=(InplaceTask &&other) noexcept{
+        if(this != &other){
+            clear();
+            moveFrom(other);
+        }
+        return *this;
+    }
+
+    InplaceTask &operator=(std::nullptr_t){
+        clear();
+        return *this;
+    }
+
+    InplaceTask(const InplaceTask &) = delete;
+    InplaceTask &operator=(const InplaceTask &) = delete;
+
+    ~InplaceTask(){ clear(); }
+
+    void operator()(){ m_ops->invoke(&m_storage); }
+
+    explicit operator bool() const { return m_ops != nullptr; }
+
+    void swap(InplaceTask &other){
+        InplaceTask tmp(std::move(other));
+        other = std::move(*this);
+        *this = std::move(tmp);
+    }
+
+    //*可调用对象能否不分配堆内存直接存放
+    template <class F>
+    static constexpr bool FitsInline(){ return Fits<typename std::decay<F>::type>::value; }
+
+private:
+    struct Ops{
+        void (*invoke)(void *);
+        //*把src中的对象移动构造到dst，并析构src中的对象
+        void (*move)(void *dst, void *src);
+        void (*destroy)(void *);
+    };
+
+    template <class Fn>
+    struct Fits : std::integral_constant<bool,
+        sizeof(Fn) <= N && alignof(Fn) <= alignof(std::max_align_t)
+        && std::is_nothrow_move_constructible<Fn>::value> {};
+
+    //*对象直接存放在缓冲区里
+    template <class Fn>
+    struct InlineOps{
+        static void Invoke(void *p){ (*static_cast<Fn *>(p))(); }
+        static void Move(void *dst, void *src){
+            Fn *s = static_cast<Fn *>(src);
+            ::new(dst) Fn(std::move(*s));
+            s->~Fn();
+        }
+        static void Destroy(void *p){ static_cast<Fn *>(p)->~Fn(); }
+        static const Ops *Get(){
+            static const Ops ops = {&Invoke, &Move, &Destroy};
+            return &ops;
+        }
+    };
+
+    //*缓冲区里只存放指向堆上对象的指针
+    template <class Fn>
+    struct HeapOps{
+        static void Invoke(void *p){ (**static_cast<Fn **>(p))(); }
+        static void Move(void *dst, void *src){
+            *static_cast<Fn **>(dst) = *static_cast<Fn **>(src);
+        }
+        static void Destroy(void *p){ delete *static_cast<Fn **>(p); }
+        static const Ops *Get(){
+            static const Ops ops = {&Invoke, &Move, &Destroy};
+            return &ops;
+        }
+    };
+
+    template <class Fn>
+    struct NullCheck{
+        static bool IsNull(const Fn &) { return false; }
+    };
+    template <class R, class... Args>
+    struct NullCheck<R (*)(Args...)>{
+        static bool IsNull(R (*f)(Args...)) { return f == nullptr; }
+    };
+    template <class Sig>
+    struct NullCheck<std::function<Sig>>{
+        static bool IsNull(const std::function<Sig> &f) { return !f; }
+    };
+
+    template <class Fn, class F>
+    void Construct(F &&f, std::true_type){
+        ::new(&m_storage) Fn(std::forward<F>(f));
+        m_ops = InlineOps<Fn>::Get();
+    }
+
+    template <class Fn, class F>
+    void Construct(F &&f, std::false_type){
+        static_assert(sizeof(Fn *) <= N, "InplaceTask buffer too small");
+        *reinterpret_cast<Fn **>(&m_storage) = new Fn(std::forward<F>(f));
+        m_ops = HeapOps<Fn>::Get();
+    }
+
+    void moveFrom(InplaceTask &other){
+        if(other.m_ops){
+            other.m_ops->move(&m_storage, &other.m_storage);
+            m_ops = other.m_ops;
+            other.m_ops = nullptr;
+        }
+    }
+
+    void clear(){
+        if(m_ops){
+            m_ops->destroy(&m_storage);
+            m_ops = nullptr;
+        }
+    }
+
+private:
+    typename std::aligned_storage<N, alignof(std::max_align_t)>::type m_storage;
+    const Ops *m_ops = nullptr;
+};
+
+//*调度器、定时器、IO事件使用的回调类型，64字节以内的捕获不分配堆内存
+typedef InplaceTask<64> TaskFunc;
+
+}//myconcurrent
@@ -1,5 +1,7 @@
-#include <unistd.h>    // for pipe()
+#include <unistd.h>
 #include <sys/epoll.h> // for epoll_xxx()
+#include <sys/eventfd.h> // for eventfd()
+#include <poll.h>
 #include <fcntl.h> 
 #include "iomanager.h"
 #include <stdexcept>
@@ -31,9 +33,9 @@ void IOManager::FdContext::resetEventContext(EventContext &ctx) {
     ctx.cb = nullptr;
 }
 
-void IOManager::FdContext::triggerEvent(IOManager::Event event) {
+void IOManager::FdContext::triggerEvent(IOManager::Event event, std::vector<ScheduleTask> *batch) {
     //待触发事件必须已经被注册过
-    if(events & event){
+    if(!(events & event)){
         LOG_ERROR<<"This event is not registered";
         assert(false);
     }
@@ -45,36 +47,48 @@ void IOManager::FdContext::triggerEvent(IOManager::Event event) {
 
     //*调度对应的协程
     EventContext &ctx = getEventContext(event);
-    if (ctx.cb) {
-        ctx.scheduler->schedule(ctx.cb);
+    //*IO事件唤醒的一般是等待中的请求协程，按高优先级调度
+    if (batch && ctx.scheduler == Scheduler::GetThis()) {
+        if (ctx.cb) {
+            batch->emplace_back(std::move(ctx.cb), -1, Scheduler::HIGH);
+        } else {
+            batch->emplace_back(std::move(ctx.fiber), -1, Scheduler::HIGH);
+        }
+    } else if (ctx.cb) {
+        ctx.scheduler->schedule(std::move(ctx.cb), -1, Scheduler::HIGH);
     } else {
-        ctx.scheduler->schedule(ctx.fiber);
+        ctx.scheduler->schedule(ctx.fiber, -1, Scheduler::HIGH);
     }
     resetEventContext(ctx);
     return;
 }
 
-IOManager::IOManager(size_t threads, bool use_caller, const std::string &name)
-    : Scheduler(threads, use_caller, name){
+IOManager::IOManager(size_t threads, bool use_caller, const std::string &name,
+                     const std::vector<int> &cpus, size_t max_threads)
+    : Scheduler(threads, use_caller, name, cpus, max_threads){
         m_epfd = epoll_create(500);
         assert(m_epfd> 0);
 
-    int rt = pipe(m_tickleFds);
-    assert(!rt);
-
-    //* 关注pipe读句柄的可读事件，用于tickle协程
-    epoll_event event;
-    memset(&event, 0, sizeof(epoll_event));
-    event.events  = EPOLLIN | EPOLLET;
-    event.data.fd = m_tickleFds[0];
-
-    //*非堵塞
-    rt = fcntl(m_tickleFds[0],F_SETFL,O_NONBLOCK);
-    assert(!rt);
-
-    //*对管道读端进行检测
-    rt = epoll_ctl(m_epfd,EPOLL_CTL_ADD,m_tickleFds[0],&event);
-    assert(!rt);
+    //* 每个工作线程一个eventfd用于tickle，以及一个私有epoll同时监听它和共享的m_epfd
+    for(size_t i = 0; i < getWorkerCount(); ++i){
+        std::unique_ptr<Waker> waker(new Waker);
+        waker->wakeFd = eventfd(0, EFD_CLOEXEC);
+        assert(waker->wakeFd >= 0);
+        waker->epfd = epoll_create(2);
+        assert(waker->epfd > 0);
+
+        epoll_event event;
+        memset(&event, 0, sizeof(epoll_event));
+        event.events  = EPOLLIN;
+        event.data.fd = waker->wakeFd;
+        int rt = epoll_ctl(waker->epfd, EPOLL_CTL_ADD, waker->wakeFd, &event);
+        assert(!rt);
+
+        event.data.fd = m_epfd;
+        rt = epoll_ctl(waker->epfd, EPOLL_CTL_ADD, m_epfd, &event);
+        assert(!rt);
+        m_wakers.push_back(std::move(waker));
+    }
 
     contextResize(32);
 
@@ -84,8 +98,10 @@ IOManager::IOManager(size_t threads, bool use_caller, const std::string &name)
 IOManager::~IOManager() {
     stop();
     close(m_epfd);
-    close(m_tickleFds[0]);
-    close(m_tickleFds[1]);
+    for (auto &waker : m_wakers) {
+        close(waker->epfd);
+        close(waker->wakeFd);
+    }
 
     for (size_t i = 0; i < m_fdContexts.size(); ++i) {
         if (m_fdContexts[i]) {
@@ -106,7 +122,11 @@ void IOManager::contextResize(size_t size) {
     }
 }
 
-int IOManager::addEvent(int fd, Event event, std::function<void()> cb){
+int IOManager::addEvent(int fd, Event event, TaskFunc cb){
+    if(m_cancelling){
+        errno = ECANCELED;
+        return -1;
+    }
     FdContext *fd_ctx = nullptr;
     if((int)m_fdContexts.size() > fd){
         MutexLockGuard Mutex(m_mutex);
@@ -150,11 +170,15 @@ int IOManager::addEvent(int fd, Event event, std::function<void()> cb){
     event_ctx.scheduler = Scheduler::GetThis();
 
     if(cb){
-        event_ctx.cb.swap(cb);
+        event_ctx.cb = std::move(cb);
     }else{
         event_ctx.fiber = Fiber::GetThis();
         assert(event_ctx.fiber->getState() == Fiber::RUNNING);
     }
+
+    //*没有线程在epoll上等待时，唤醒一个阻塞的空闲线程来监听
+    if(m_poller == -1)
+        wakeParked();
     return 0;
 }
 
@@ -289,8 +313,31 @@ IOManager *IOManager::GetThis() {
 void IOManager::tickle(){
     LOG_DEBUG<<"tickle";
     if(!hasIdleThreads()) return;
-    int rt = write(m_tickleFds[1],"T",1);
-    assert(rt ==1 ); 
+    //*优先唤醒阻塞在eventfd上的线程，负责epoll的线程继续监听IO
+    if(wakeParked()) return;
+    int poller = m_poller;
+    if(poller >= 0)
+        tickleWorker(poller);
+}
+
+void IOManager::tickleWorker(size_t idx){
+    uint64_t one = 1;
+    int rt = write(m_wakers[idx]->wakeFd, &one, sizeof(one));
+    assert(rt == sizeof(one));
+}
+
+bool IOManager::wakeParked(){
+    int me = getWorkerIndex();
+    for(size_t i = 0; i < m_wakers.size(); ++i){
+        if((int)i == me)
+            continue;
+        bool expected = true;
+        if(m_wakers[i]->parked.compare_exchange_strong(expected, false)){
+            tickleWorker(i);
+            return true;
+        }
+    }
+    return false;
 }
 
 bool IOManager::stopping(){
@@ -302,7 +349,32 @@ bool IOManager::stopping(uint64_t &timeout){
     //对于IOManager二元，必须等所有待调度的IO事件执行完才能退出
     //而且得保证没有剩余的定时器触发
      timeout = getNextTimer();
-    return timeout == ~0ull && m_pendingEventCount == 0 && Scheduler::stopping();
+    //*限时停止到期后新加的定时器不再等待
+    bool timers_done = timeout == ~0ull || m_cancelling;
+    return timers_done && m_pendingEventCount == 0 && Scheduler::stopping();
+}
+
+void IOManager::onStopDeadline(StopReport &report){
+    m_cancelling = true;
+    std::vector<TaskFunc> cbs;
+    report.expiredTimers += expireAll(cbs);
+    scheduleBatch(std::make_move_iterator(cbs.begin()), std::make_move_iterator(cbs.end()));
+
+    std::vector<int> fds;
+    {
+        MutexLockGuard lock(m_mutex);
+        for(size_t i = 0; i < m_fdContexts.size(); ++i){
+            MutexLockGuard fd_lock(m_fdContexts[i]->m_mutex);
+            if(m_fdContexts[i]->events)
+                fds.push_back((int)i);
+        }
+    }
+    //*cancelAll触发一次事件，等待的协程恢复后重新addEvent会失败，带着错误返回
+    for(int fd : fds){
+        size_t before = m_pendingEventCount;
+        if(cancelAll(fd))
+            report.cancelledEvents += before - m_pendingEventCount;
+    }
 }
 /**
  * *调度器无调度任务时会阻塞idle协程上，对IO调度器而言，idle状态应该关注两件事，一是有没有新的调度任务，对应Schduler::schedule()，
@@ -320,16 +392,97 @@ void IOManager::idle(){
         delete[]  ptr;
     });
 
+    int me = getWorkerIndex();
+    assert(me >= 0);
+    Waker &waker = *m_wakers[me];
+
+    //*一轮epoll_wait得到的定时器回调和IO事件回调，最后一次性加入调度
+    std::vector<TaskFunc> cbs;
+    std::vector<ScheduleTask> tasks;
+    tasks.reserve(MAX_EVNETS);
+
     while(true){
         //获取定时器下一个超时的时间，顺便判断调度器是否停止
         uint64_t next_timeout = 0;
         if(stopping(next_timeout)){
             LOG_DEBUG<<"name = "<<getName()<<"idle stopping exit";
+            //*唤醒其余阻塞的线程，让它们也能看到停止状态
+            while(wakeParked())
+                ;
             break;
         }
-        //* 阻塞在epoll_wait上，等待事件发生或定时器超时
+
+        int expected = -1;
+        if(!m_poller.compare_exchange_strong(expected, me)){
+            //*已经有线程负责epoll，先自旋等任务或者epoll空出来，等不到再阻塞在自己的eventfd上，直到被指定唤醒
+            if(spinUntil([this](){ return hasReadyTask() || m_poller == -1; })){
+                countIdle(SPIN_WIN);
+                Fiber::GetThis()->yield();
+                continue;
+            }
+            //*先置parked再复查，和tickle一侧先入队再检查parked配对，避免丢失通知
+            waker.parked = true;
+            bool timeout = false;
+            if(!hasReadyTask() && m_poller != -1){
+                countIdle(PARKED);
+                //*多余的线程限时等待，空闲超时后退出
+                int retire_ms = (int)retireTimeoutMs();
+                pollfd pfd;
+                pfd.fd = waker.wakeFd;
+                pfd.events = POLLIN;
+                int rt = 1;
+                if(retire_ms > 0){
+                    do{
+                        rt = poll(&pfd, 1, retire_ms);
+                    } while(rt < 0 && errno == EINTR);
+                }
+                if(rt == 0){
+                    timeout = true;
+                }else{
+                    uint64_t dummy;
+                    while(read(waker.wakeFd, &dummy, sizeof(dummy)) < 0 && errno == EINTR)
+                        ;
+                }
+            }
+            //*超时的同时被tickle选中，按被唤醒处理
+            if(!waker.parked.exchange(false))
+                timeout = false;
+            if(timeout && tryRetire())
+                break;
+            Fiber::GetThis()->yield();
+            continue;
+        }
+        if(hasReadyTask()){
+            m_poller = -1;
+            Fiber::GetThis()->yield();
+            continue;
+        }
+
+        //*自旋阶段：零超时地检查任务队列和私有epoll，预算内有结果就不用阻塞
+        epoll_event wait_events[2];
         int rt = 0;
-        do{
+        bool spin_task = false;
+        if(next_timeout == 0){
+            //*已经有定时器超时，只顺带检查一下IO，不等待
+            rt = epoll_wait(waker.epfd, wait_events, 2, 0);
+        }else if(spinUntil([&](){
+                if(hasReadyTask()){
+                    spin_task = true;
+                    return true;
+                }
+                rt = epoll_wait(waker.epfd, wait_events, 2, 0);
+                return rt > 0;
+            })){
+            if(spin_task){
+                countIdle(SPIN_WIN);
+                m_poller = -1;
+                Fiber::GetThis()->yield();
+                continue;
+            }
+            countIdle(POLL_WIN);
+        }else{
+            //* 阻塞在epoll_wait上，等待事件发生、定时器超时或者被tickle
+            countIdle(PARKED);
             // *默认超时时间5秒，如果下一个定时器的超时时间大于5秒，仍以5秒来计算超时，避免定时器超时时间太大时，epoll_wait一直阻塞
             static const int MAX_TIMEOUT = 5000;
             if(next_timeout != ~0ull) {
@@ -337,34 +490,40 @@ void IOManager::idle(){
             } else {
                 next_timeout = MAX_TIMEOUT;
             }
-            rt = epoll_wait(m_epfd, events, MAX_EVNETS, (int)next_timeout);
-            if(rt < 0 && errno == EINTR) {
-                continue;
-            } else {
-                break;
+            do{
+                rt = epoll_wait(waker.epfd, wait_events, 2, (int)next_timeout);
+            } while(rt < 0 && errno == EINTR);
+        }
+
+        bool io_ready = false;
+        for(int i = 0; i < rt; ++i){
+            if(wait_events[i].data.fd == waker.wakeFd){
+                //* eventfd用于通知协程调度，读掉计数即可
+                uint64_t dummy;
+                read(waker.wakeFd, &dummy, sizeof(dummy));
+            }else{
+                io_ready = true;
             }
-        } while(true);
+        }
+        m_poller = -1;
+
+        rt = 0;
+        if(io_ready)
+            rt = epoll_wait(m_epfd, events, MAX_EVNETS, 0);
+
+        //*交出epoll之后，如果还有需要监听的IO事件或定时器，唤醒一个阻塞的线程接手
+        if(m_pendingEventCount > 0 || hasTimer())
+            wakeParked();
 
           // 收集所有已超时的定时器，执行回调函数
-        std::vector<std::function<void()>> cbs;
         listExpiredCb(cbs);
-        if(!cbs.empty()) {
-            for(const auto &cb : cbs) {
-                schedule(cb);
-            }
-            cbs.clear();
+        for(auto &cb : cbs) {
+            tasks.emplace_back(std::move(cb), -1);
         }
+        cbs.clear();
          // 遍历所有发生的事件，根据epoll_event的私有指针找到对应的FdContext，进行事件处理
         for (int i = 0; i < rt; ++i) {
             epoll_event &event = events[i];
-            if (event.data.fd == m_tickleFds[0]) {
-                // ticklefd[0]用于通知协程调度，这时只需要把管道里的内容读完即可
-                uint8_t dummy[256];
-                while (read(m_tickleFds[0], dummy, sizeof(dummy)) > 0)
-                    ;
-                continue;
-            }
-
             FdContext *fd_ctx = (FdContext *)event.data.ptr;
             MutexLockGuard Mutex(fd_ctx->m_mutex);
             
@@ -403,15 +562,22 @@ void IOManager::idle(){
 
             // 处理已经发生的事件，也就是让调度器调度指定的函数或协程
             if (real_events & READ) {
-                fd_ctx->triggerEvent(READ);
+                fd_ctx->triggerEvent(READ, &tasks);
                 --m_pendingEventCount;
             }
             if (real_events & WRITE) {
-                fd_ctx->triggerEvent(WRITE);
+                fd_ctx->triggerEvent(WRITE, &tasks);
                 --m_pendingEventCount;
             }
         } // end for
 
+        //*一次加锁把这一轮的任务全部入队，只唤醒需要的空闲线程
+        if(!tasks.empty()) {
+            scheduleBatch(std::make_move_iterator(tasks.begin()),
+                          std::make_move_iterator(tasks.end()));
+            tasks.clear();
+        }
+
         /**
          * 一旦处理完所有的事件，idle协程yield，这样可以让调度协程(Scheduler::run)重新检查是否有新任务要调度
          * 上面triggerEvent实际也只是把对应的fiber重新加入调度，要执行的话还要等idle协程退出
@@ -425,7 +591,12 @@ void IOManager::idle(){
   
 }
     void IOManager::onTimerInsertedAtFront() {
-    tickle();
+    //*让负责epoll的线程按新的超时时间重新等待，没有的话唤醒一个线程来负责
+    int poller = m_poller;
+    if(poller >= 0)
+        tickleWorker(poller);
+    else
+        wakeParked();
 }
 
 }
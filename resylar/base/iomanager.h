@@ -6,6 +6,7 @@
 namespace myconcurrent{
     
 class IOManager : public Scheduler, public TimerManager{
+public:
     typedef std::shared_ptr<IOManager> ptr;
 
     /**
@@ -19,7 +20,7 @@ class IOManager : public Scheduler, public TimerManager{
     //*读事件（EPOLLIN）
     READ = 0x1,
     //*写事件（EPOLLOUT）
-    WRITE = 0x3,
+    WRITE = 0x4,
    };
 private:
     //?fd上下文类
@@ -33,8 +34,8 @@ private:
             //*事件回调协程
             Fiber::ptr fiber;
 
-            //*事件回调函数
-            std::function<void()> cb;
+            //*事件回调函数，只能移动，触发时直接移交给调度器
+            TaskFunc cb;
         };
 
         //*获取事件上下文的类
@@ -45,7 +46,8 @@ private:
 
         //*触发事件
         //*根据事件类型调用对应上下文结构中的调度器去调度回调协程或回调函数
-        void triggerEvent(Event event);
+        //*batch不为空时，属于当前调度器的任务先收集起来，由调用者批量调度
+        void triggerEvent(Event event, std::vector<ScheduleTask> *batch = nullptr);
 
         //*读事件上下文
         EventContext read;
@@ -69,8 +71,11 @@ public:
      **threads 线程的数量
      **use_caller 是否将调用线程包含进去
      **调度器名称
+     **cpus 工作线程依次绑定的CPU，为空表示不绑核
+     **max_threads 线程数上限，大于threads时随负载伸缩，见Scheduler
     */
-    IOManager(size_t threads = 1, bool use_caller = true, const std::string &name = "IOManager");
+    IOManager(size_t threads = 1, bool use_caller = true, const std::string &name = "IOManager",
+              const std::vector<int> &cpus = {}, size_t max_threads = 0);
 
    /**
     **析构函数
@@ -79,7 +84,7 @@ public:
 
     //*增添事件
     //* cb事件回调函数，如果为空，默认把当前协程作为回调执行体
-    int addEvent(int fd, Event event, std::function<void()>cb=nullptr);
+    int addEvent(int fd, Event event, TaskFunc cb=nullptr);
 
     //*删除事件
     bool delEvent(int fd, Event event);
@@ -93,10 +98,16 @@ public:
     //*返回当前的IOManager
     static IOManager *GetThis();
 
+    //*已注册还没有触发的IO事件数
+    size_t getPendingEventCount() const { return m_pendingEventCount.load(std::memory_order_acquire); }
+
 protected:
     //*通知调度器有任务要调度
     void tickle() override;
 
+    //*通知指定的工作线程
+    void tickleWorker(size_t idx) override;
+
     //判断是否可以停止
     bool stopping() override;
 
@@ -105,19 +116,41 @@ protected:
 
     bool stopping(uint64_t& timeout);
 
+    //*限时停止到期：之后不再接受新的IO事件，取消所有已注册的事件，提前触发所有定时器
+    void onStopDeadline(StopReport &report) override;
+
     //*当有定时器插入到头部时，要重新更新epoll_wait的超时时间，这里是唤醒idle协程以便于使用新的超时时间
     void onTimerInsertedAtFront() override;
 
     //*重置socket句柄上下文的容器大小
     void contextResize(size_t size);
 
+    //*唤醒一个阻塞在eventfd上的工作线程，没有则返回false
+    bool wakeParked();
+
 private:
     //* epoll 文件句柄
     int m_epfd = 0;
-    //* pipe 文件句柄，fd[0]读端，fd[1]写端
-    int m_tickleFds[2];
+    /**
+     * *每个工作线程的唤醒句柄
+     * *同一时刻只有一个空闲线程在m_epfd上等待IO事件和定时器（负责epoll的线程），其他空闲线程阻塞在自己的eventfd上
+     * *这样tickle可以只唤醒指定的线程，而不是让所有线程都从epoll_wait返回
+     */
+    struct Waker{
+        //*eventfd，tickle时写入
+        int wakeFd = -1;
+        //*私有epoll，监听wakeFd和共享的m_epfd，只有负责epoll的线程在上面等待
+        int epfd = -1;
+        //*是否阻塞在wakeFd上
+        std::atomic<bool> parked = {false};
+    };
+    std::vector<std::unique_ptr<Waker>> m_wakers;
+    //* 当前负责epoll的工作线程序号，-1表示没有
+    std::atomic<int> m_poller = {-1};
     //* 当前等待执行的IO事件数量
     std::atomic<size_t> m_pendingEventCount = {0};
+    //* 限时停止已经到期，addEvent返回失败，不再等待定时器
+    std::atomic<bool> m_cancelling = {false};
     //* IOManager的Mutex
     mutable MutexLock m_mutex;
     //* socket事件上下文的容器
@@ -0,0 +1,79 @@
+#pragma once
+#include <cstddef>
+#include <memory>
+#include <utility>
+
+namespace myconcurrent{
+
+/**
+ * *基于环形数组的双端队列，只在容量不够时翻倍扩容，出队不释放内存
+ * *std::deque按块分配，元素较大时几乎每几次入队就要分配一次，稳定运行时这里不再分配内存
+ */
+template <class T>
+class RingQueue{
+public:
+    RingQueue() {}
+    RingQueue(const RingQueue &) = delete;
+    RingQueue &operator=(const RingQueue &) = delete;
+
+    ~RingQueue(){
+        while(!empty())
+            pop_front();
+    }
+
+    size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+
+    T &front() { return at(0); }
+    T &back() { return at(m_size - 1); }
+
+    void push_back(T &&v){
+        if(m_size == m_capacity){
+            //*v可能就是队列中的元素，扩容前先移出来
+            T tmp(std::move(v));
+            grow();
+            ::new(slot(m_size)) T(std::move(tmp));
+        }else{
+            ::new(slot(m_size)) T(std::move(v));
+        }
+        ++m_size;
+    }
+
+    void pop_front(){
+        at(0).~T();
+        m_head = (m_head + 1) & (m_capacity - 1);
+        --m_size;
+    }
+
+    void pop_back(){
+        at(m_size - 1).~T();
+        --m_size;
+    }
+
+private:
+    T *slot(size_t i) { return reinterpret_cast<T *>(m_buf.get()) + ((m_head + i) & (m_capacity - 1)); }
+    T &at(size_t i) { return *slot(i); }
+
+    void grow(){
+        size_t cap = m_capacity ? m_capacity * 2 : 16;
+        std::unique_ptr<Storage[]> buf(new Storage[cap]);
+        T *dst = reinterpret_cast<T *>(buf.get());
+        for(size_t i = 0; i < m_size; ++i){
+            ::new(dst + i) T(std::move(at(i)));
+            at(i).~T();
+        }
+        m_buf.swap(buf);
+        m_capacity = cap;
+        m_head = 0;
+    }
+
+private:
+    typedef typename std::aligned_storage<sizeof(T), alignof(T)>::type Storage;
+    std::unique_ptr<Storage[]> m_buf;
+    //*容量总是2的幂
+    size_t m_capacity = 0;
+    size_t m_head = 0;
+    size_t m_size = 0;
+};
+
+}//myconcurrent
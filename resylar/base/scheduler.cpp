@@ -1,4 +1,13 @@
 #include "scheduler.h"
+#include <dirent.h>
+#include <errno.h>
+#include <execinfo.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
 #include "hook.h"
 #include "CurrentThread.h"
 
@@ -10,13 +19,68 @@ static thread_local Scheduler *t_scheduler = nullptr;
 //*当前线程的调度协程，每个线程只要一个
 static thread_local Fiber *t_scheduler_fiber = nullptr;
 
-Scheduler::Scheduler(size_t threads, bool use_caller,const std::string &name)
+//*当前线程在所属调度器中的本地队列
+static thread_local void *t_worker = nullptr;
+
+//*当前线程是限时停止的到期线程，它取消事件时提交的回调不被拒绝
+static thread_local bool t_stop_driver = false;
+
+//*看门狗抓调用栈用的信号，0表示默认的SIGRTMIN+2(SIGRTMIN不是编译期常量)
+static int s_backtraceSignal = 0;
+//*正在运行的看门狗个数和安装前的处理方式，s_signalMutex保护
+static MutexLock s_signalMutex;
+static int s_signalUsers = 0;
+static struct sigaction s_oldAction;
+
+//*从全局注入队列一次最多搬到本地队列的任务数
+static const size_t kGlobalBatch = 32;
+
+//*低优先级任务在有任务的情况下最多被连续跳过的次数，超过后插队执行一次
+static const uint32_t kMaxSkipped = 8;
+
+//*从sysfs查CPU所在的NUMA节点，查不到返回0
+static int CpuToNode(int cpu){
+    std::string path = "/sys/devices/system/cpu/cpu" + std::to_string(cpu);
+    DIR *dir = opendir(path.c_str());
+    if(!dir)
+        return 0;
+    int node = 0;
+    while(struct dirent *ent = readdir(dir)){
+        if(strncmp(ent->d_name, "node", 4) == 0){
+            node = atoi(ent->d_name + 4);
+            break;
+        }
+    }
+    closedir(dir);
+    return node;
+}
+
+std::vector<int> Scheduler::GetAvailableCpus(){
+    std::vector<int> cpus;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if(sched_getaffinity(0, sizeof(set), &set) == 0){
+        for(int i = 0; i < CPU_SETSIZE; ++i){
+            if(CPU_ISSET(i, &set))
+                cpus.push_back(i);
+        }
+    }
+    return cpus;
+}
+
+Scheduler::Scheduler(size_t threads, bool use_caller,const std::string &name,
+                     const std::vector<int> &cpus, size_t max_threads)
+    :m_cpus(cpus),
+     m_watchdogCond(m_watchdogMutex)
 {
     assert(threads > 0);
+    if(max_threads < threads)
+        max_threads = threads;
     m_useCaller = use_caller;
     m_name =name;
     if(use_caller){
         --threads;
+        --max_threads;
         myconcurrent::Fiber::GetThis();
         assert(GetThis()== nullptr );
         t_scheduler = this;
@@ -28,7 +92,44 @@ Scheduler::Scheduler(size_t threads, bool use_caller,const std::string &name)
     }else{
         m_rootThread = -1;
     }
+    //*伸缩时至少保留一个工作线程，由它观察排队时间
+    if(max_threads > threads && threads == 0)
+        threads = 1;
     m_threadCount = threads;
+    m_maxThreads = max_threads;
+
+    /**
+     * *工作线程在前，按上限预先分配好槽位，之后m_workers不再变化；caller线程的队列放在最后
+     * *绑核的槽位由绑在对应CPU上的临时线程分配Worker，按first touch让内存落在本地NUMA节点；
+     * *构造函数返回之前其他线程还看不到m_workers，槽位上的Worker之后不再替换
+     */
+    size_t workers = m_maxThreads + (use_caller ? 1 : 0);
+    m_workers.resize(workers);
+    std::vector<Thread::ptr> placers;
+    for(size_t i = 0; i < m_maxThreads && !m_cpus.empty(); ++i){
+        int cpu = m_cpus[i % m_cpus.size()];
+        Thread::ptr placer(new Thread([this, i, cpu](){
+            m_workers[i].reset(new Worker);
+            m_workers[i]->node = CpuToNode(cpu);
+        }, m_name + "_place_" + std::to_string(i)));
+        placer->setCpuAffinity({cpu});
+        placer->start();
+        if(placer->started())
+            placers.push_back(placer);
+    }
+    for(auto &placer : placers)
+        placer->join();
+    for(size_t i = 0; i < workers; ++i){
+        //*没有绑核或者临时线程没有起来的槽位在这里分配
+        if(!m_workers[i])
+            m_workers[i].reset(new Worker);
+        m_workers[i]->index = i;
+    }
+    if(use_caller){
+        t_worker = m_workers.back().get();
+        m_workers.back()->tid = m_rootThread;
+        m_workers.back()->running = true;
+    }
 }
 
 Scheduler *Scheduler::GetThis(){
@@ -43,6 +144,96 @@ void Scheduler::setThis(){
     t_scheduler = this;
 }
 
+bool Scheduler::InFiber(){
+    if(!t_scheduler || !t_scheduler_fiber)
+        return false;
+    //*线程主协程和caller线程的调度协程都不参与调度，不能在里面让出
+    //*共享栈协程切出后栈上的内容会被换走，等待者不能放在它的栈上，同步等待时阻塞线程
+    Fiber::ptr cur = Fiber::GetThis();
+    return cur->isRunInScheduler() && cur.get() != t_scheduler_fiber && !cur->isSharedStack();
+}
+
+bool Scheduler::SliceExpired(){
+    Worker *self = static_cast<Worker *>(t_worker);
+    return self && self->preempt.load(std::memory_order_relaxed);
+}
+
+Scheduler::Worker *Scheduler::currentWorker() const{
+    if(t_scheduler != this)
+        return nullptr;
+    return static_cast<Worker *>(t_worker);
+}
+
+int Scheduler::getWorkerIndex() const{
+    Worker *self = currentWorker();
+    return self ? (int)self->index : -1;
+}
+
+Scheduler::Worker *Scheduler::findWorker(int tid) const{
+    for(auto &w : m_workers){
+        if(w->tid == tid)
+            return w.get();
+    }
+    return nullptr;
+}
+
+bool Scheduler::hasReadyTask() const{
+    Worker *self = currentWorker();
+    return m_taskCount > 0 || (self && self->pinned > 0);
+}
+
+bool Scheduler::rejectsExternal() const{
+    return m_draining.load(std::memory_order_relaxed) && !t_stop_driver && !currentWorker();
+}
+
+bool Scheduler::enqueue(ScheduleTask &task){
+    //*协程是已经在执行的任务被唤醒，总是接受
+    if(!task.fiber && rejectsExternal()){
+        ++m_rejectedTasks;
+        return false;
+    }
+    task.enqueueNs = NowNs();
+    if(task.thread != -1){
+        //*指定了线程的任务直接投递到目标线程的信箱，只唤醒目标线程
+        Worker *target = findWorker(task.thread);
+        if(target){
+            bool delivered = false;
+            {
+                MutexLockGuard lock(target->mailboxMutex);
+                //*目标线程可能刚刚空闲退出
+                if(target->tid == task.thread){
+                    target->mailbox.push(std::move(task));
+                    ++m_pinnedCount;
+                    ++target->pinned;
+                    delivered = true;
+                }
+            }
+            if(delivered){
+                if(target->idle)
+                    tickleWorker(target->index);
+                return true;
+            }
+        }
+        LOG_ERROR<<"schedule to unknown thread "<<task.thread<<", run on any thread";
+        task.thread = -1;
+    }
+
+    //*计数在锁内、任务可见之前增加，出队一方先减时不会下溢，stopping()也不会看到任务还在队列里时计数为0
+    Worker *self = currentWorker();
+    if(self){
+        MutexLockGuard lock(self->mutex);
+        ++m_taskCount;
+        self->local.push(std::move(task));
+    }else{
+        MutexLockGuard lock(m_mutex);
+        ++m_taskCount;
+        m_tasks.push(std::move(task));
+    }
+    if(hasIdleThreads()) // 唤醒idle协程
+        tickle();
+    return true;
+}
+
 Scheduler::~Scheduler(){
     t_scheduler = this;
     LOG_DEBUG<<"Scheduler::~Scheduler";
@@ -59,28 +250,376 @@ void Scheduler::start(){
         return;
     }
     assert(m_threads.empty());
-    m_threads.resize(m_threadCount);
+    m_threads.resize(m_maxThreads);
     for(size_t i = 0; i<m_threadCount;i++){
-        m_threads[i].reset(new Thread(std::bind(&Scheduler::run,this),m_name+"_"+std::to_string(i)));
-        m_threadIds.push_back(m_threads[i]->tid());
+        if(!spawnWorker(i)){
+            LOG_ERROR<<"Scheduler start thread "<<i<<" failed";
+            assert(false);
+        }
     }
 }
 
-bool Scheduler::stopping(){
-    MutexLockGuard mtlock(m_mutex);
+bool Scheduler::spawnWorker(size_t i){
+    //*槽位上原来的线程已经退出，回收掉
+    if(m_threads[i])
+        m_threads[i]->join();
+    m_workers[i]->running = true;
+    ++m_runningThreads;
+    m_threads[i].reset(new Thread([this, i](){
+        Worker *self = m_workers[i].get();
+        {
+            MutexLockGuard lock(self->mailboxMutex);
+            self->tid = myconcurrent::CurrentThread::tid();
+        }
+        t_worker = self;
+        //*等启动方登记完线程再开始调度
+        { MutexLockGuard lock(m_mutex); }
+        run();
+    },m_name+"_"+std::to_string(i)));
+    if(!m_cpus.empty())
+        m_threads[i]->setCpuAffinity({m_cpus[i % m_cpus.size()]});
+    m_threads[i]->start();
+    if(!m_threads[i]->started()){
+        m_threads[i].reset();
+        --m_runningThreads;
+        m_workers[i]->running = false;
+        return false;
+    }
+    m_threadIds.push_back(m_threads[i]->tid());
+    return true;
+}
+
+void Scheduler::grow(){
+    bool expected = false;
+    if(!m_growing.compare_exchange_strong(expected, true))
+        return;
+    {
+        MutexLockGuard lock(m_mutex);
+        if(!m_stopping && m_runningThreads < m_maxThreads){
+            for(size_t i = 0; i < m_maxThreads; ++i){
+                if(m_workers[i]->running)
+                    continue;
+                if(spawnWorker(i)){
+                    LOG_DEBUG<<"Scheduler "<<m_name<<" grow to "<<m_runningThreads<<" threads";
+                }else{
+                    LOG_ERROR<<"Scheduler "<<m_name<<" grow thread "<<i<<" failed";
+                }
+                break;
+            }
+        }
+    }
+    m_growing = false;
+}
+
+uint64_t Scheduler::retireTimeoutMs() const{
+    Worker *self = currentWorker();
+    //*caller线程不退出
+    if(!self || m_maxThreads <= m_threadCount || self->index >= m_maxThreads)
+        return 0;
+    return m_retireIdleMs;
+}
 
-    return m_stopping && m_tasks.empty() && m_activeThreadCount == 0;
+bool Scheduler::tryRetire(){
+    Worker *self = currentWorker();
+    if(!self || m_stopping || hasReadyTask())
+        return false;
+    //*绑定在本线程的共享栈协程只能在这里继续执行
+    if(Fiber::BoundSharedFibers() > 0)
+        return false;
+    size_t n = m_runningThreads;
+    while(n > m_threadCount){
+        if(m_runningThreads.compare_exchange_weak(n, n - 1)){
+            self->retiring = true;
+            return true;
+        }
+    }
+    return false;
+}
+
+//*协程池的高低水位，全局池最多缓存的协程数
+static const size_t kFiberPoolHigh = 64;
+static const size_t kFiberPoolLow = 32;
+static const size_t kGlobalFiberPoolMax = 1024;
+
+Fiber::ptr Scheduler::takeFiber(Worker *self, size_t stacksize){
+    std::vector<Fiber::ptr> &pool = self->fiberPool;
+    if(pool.empty()){
+        //*一次取回到低水位，避免每个回调都去抢全局池的锁
+        MutexLockGuard lock(m_fiberPoolMutex);
+        size_t n = std::min(kFiberPoolLow, m_fiberPool.size());
+        for(size_t i = 0; i < n; ++i){
+            pool.push_back(std::move(m_fiberPool.back()));
+            m_fiberPool.pop_back();
+        }
+    }
+    //*自适应栈大小下池里可能有几种大小，从最近放回的找起
+    for(size_t i = pool.size(); i > 0; --i){
+        if(pool[i - 1]->getStackSize() == stacksize){
+            Fiber::ptr fiber = std::move(pool[i - 1]);
+            pool[i - 1] = std::move(pool.back());
+            pool.pop_back();
+            return fiber;
+        }
+    }
+    return nullptr;
+}
+
+void Scheduler::recycleFiber(Worker *self, Fiber::ptr &fiber){
+    if(fiber.use_count() != 1 || !fiber->isRunInScheduler() || fiber->isSharedStack())
+        return;
+    std::vector<Fiber::ptr> &pool = self->fiberPool;
+    pool.push_back(std::move(fiber));
+    if(pool.size() <= kFiberPoolHigh)
+        return;
+    //*超出全局上限的协程在锁外析构
+    std::vector<Fiber::ptr> overflow;
+    {
+        MutexLockGuard lock(m_fiberPoolMutex);
+        while(pool.size() > kFiberPoolLow){
+            if(m_fiberPool.size() < kGlobalFiberPoolMax)
+                m_fiberPool.push_back(std::move(pool.back()));
+            else
+                overflow.push_back(std::move(pool.back()));
+            pool.pop_back();
+        }
+    }
+}
+
+void Scheduler::releaseFibers(Worker *self){
+    std::vector<Fiber::ptr> overflow;
+    {
+        MutexLockGuard lock(m_fiberPoolMutex);
+        for(auto &fiber : self->fiberPool){
+            if(m_fiberPool.size() < kGlobalFiberPoolMax)
+                m_fiberPool.push_back(std::move(fiber));
+            else
+                overflow.push_back(std::move(fiber));
+        }
+    }
+    self->fiberPool.clear();
+}
+
+void Scheduler::retire(Worker *self){
+    std::vector<ScheduleTask> &left = self->stolen;
+    size_t pinned = 0;
+    {
+        //*清掉tid之后enqueue不会再往信箱里放任务
+        MutexLockGuard lock(self->mailboxMutex);
+        self->tid = 0;
+        self->mailbox.takeAll(left);
+        pinned = left.size();
+        self->pinned = 0;
+    }
+    //*先加后减，保证stopping()不会误判没有任务
+    m_taskCount += pinned;
+    m_pinnedCount -= pinned;
+    {
+        MutexLockGuard lock(self->mutex);
+        self->local.takeAll(left);
+    }
+    {
+        MutexLockGuard lock(m_mutex);
+        for(auto &task : left){
+            task.thread = -1;
+            m_tasks.push(std::move(task));
+        }
+        for(auto it = m_threadIds.begin(); it != m_threadIds.end(); ++it){
+            if(*it == myconcurrent::CurrentThread::tid()){
+                m_threadIds.erase(it);
+                break;
+            }
+        }
+    }
+    if(!left.empty())
+        tickleIdle(left.size());
+    left.clear();
+    LOG_DEBUG<<"Scheduler "<<m_name<<" retire worker "<<self->index<<", "<<m_runningThreads<<" threads left";
+    self->retiring = false;
+    //*交还槽位，之后不能再访问self
+    self->running = false;
+}
+
+bool Scheduler::stopping(){
+    return m_stopping && m_taskCount == 0 && m_pinnedCount == 0
+        && m_activeThreadCount == 0;
 }
 
 void Scheduler::tickle(){
     LOG_DEBUG<<"ticlke";
+    Worker *self = currentWorker();
+    for(auto &w : m_workers){
+        if(w.get() == self)
+            continue;
+        bool expected = true;
+        if(w->parked.compare_exchange_strong(expected, false)){
+            unpark(w.get());
+            return;
+        }
+    }
+}
+
+void Scheduler::tickleWorker(size_t idx){
+    unpark(m_workers[idx].get());
+}
+
+bool Scheduler::park(Worker *self, uint64_t timeout_ms){
+    //*先置parked再复查，和tickle一侧先入队再检查parked配对，避免丢失通知
+    self->parked = true;
+    bool timeout = false;
+    if(!hasReadyTask() && !stopping()){
+        MutexLockGuard lock(self->parkMutex);
+        while(!self->notified && !timeout){
+            if(timeout_ms)
+                timeout = self->parkCond.waitForMilliseconds(timeout_ms);
+            else
+                self->parkCond.wait();
+        }
+        self->notified = false;
+    }
+    //*超时的同时被tickle选中，按被唤醒处理
+    if(!self->parked.exchange(false))
+        timeout = false;
+    return !timeout;
+}
+
+void Scheduler::unpark(Worker *w){
+    {
+        MutexLockGuard lock(w->parkMutex);
+        w->notified = true;
+    }
+    w->parkCond.notify();
+}
+
+void Scheduler::countIdle(IdleResult result){
+    Worker *self = currentWorker();
+    if(self)
+        self->idleCounts[result].fetch_add(1, std::memory_order_relaxed);
+}
+
+Scheduler::IdleStats Scheduler::getIdleStats() const{
+    IdleStats stats;
+    for(auto &w : m_workers){
+        stats.spinWins += w->idleCounts[SPIN_WIN].load(std::memory_order_relaxed);
+        stats.pollWins += w->idleCounts[POLL_WIN].load(std::memory_order_relaxed);
+        stats.parks    += w->idleCounts[PARKED].load(std::memory_order_relaxed);
+    }
+    return stats;
+}
+
+Scheduler::AtomicHistogram::AtomicHistogram(){
+    for(auto &b : buckets)
+        b.store(0, std::memory_order_relaxed);
+}
+
+void Scheduler::AtomicHistogram::record(uint64_t ns){
+    int idx = ns ? 63 - __builtin_clzll(ns) : 0;
+    if(idx >= LatencyHistogram::kBuckets)
+        idx = LatencyHistogram::kBuckets - 1;
+    Bump(buckets[idx], 1);
+    Bump(sumNs, ns);
+    Bump(count, 1);
+}
+
+void Scheduler::AtomicHistogram::load(LatencyHistogram &out) const{
+    out.count = count.load(std::memory_order_relaxed);
+    out.sumNs = sumNs.load(std::memory_order_relaxed);
+    for(int i = 0; i < LatencyHistogram::kBuckets; ++i)
+        out.buckets[i] = buckets[i].load(std::memory_order_relaxed);
+}
+
+void Scheduler::LatencyHistogram::merge(const LatencyHistogram &other){
+    count += other.count;
+    sumNs += other.sumNs;
+    for(int i = 0; i < kBuckets; ++i)
+        buckets[i] += other.buckets[i];
+}
+
+uint64_t Scheduler::LatencyHistogram::percentileNs(double p) const{
+    //*快照期间count和各个桶不是同时读出的，以桶的总和为准
+    uint64_t total = 0;
+    for(int i = 0; i < kBuckets; ++i)
+        total += buckets[i];
+    if(total == 0)
+        return 0;
+    uint64_t rank = (uint64_t)(p * total);
+    if(rank >= total)
+        rank = total - 1;
+    uint64_t seen = 0;
+    for(int i = 0; i < kBuckets; ++i){
+        seen += buckets[i];
+        if(seen > rank)
+            return 2ull << i;
+    }
+    return 2ull << (kBuckets - 1);
+}
+
+Scheduler::Stats Scheduler::getStats(){
+    Stats stats;
+    {
+        MutexLockGuard lock(m_mutex);
+        stats.globalQueueDepth = m_tasks.size();
+    }
+    stats.queuedTasks   = m_taskCount + m_pinnedCount;
+    stats.activeThreads = m_activeThreadCount;
+    stats.idleThreads   = m_idleThreadCount;
+    stats.threads       = m_runningThreads;
+    stats.workers.resize(m_workers.size());
+    for(size_t i = 0; i < m_workers.size(); ++i){
+        Worker *w = m_workers[i].get();
+        WorkerStats &ws = stats.workers[i];
+        ws.index       = w->index;
+        ws.tasks       = w->tasks.load(std::memory_order_relaxed);
+        ws.busyNs      = w->busyNs.load(std::memory_order_relaxed);
+        ws.idleNs      = w->idleNs.load(std::memory_order_relaxed);
+        ws.stealOps    = w->stealOps.load(std::memory_order_relaxed);
+        ws.stolenTasks = w->stolenTasks.load(std::memory_order_relaxed);
+        ws.slowTasks   = w->slowTasks.load(std::memory_order_relaxed);
+        ws.fiberCreates = w->fiberCreates.load(std::memory_order_relaxed);
+        {
+            MutexLockGuard lock(w->mutex);
+            ws.queueDepth = w->local.size();
+        }
+        ws.queueDepth += w->pinned;
+        w->queueWait.load(ws.queueWait);
+        w->runTime.load(ws.run);
+        stats.queueWait.merge(ws.queueWait);
+        stats.run.merge(ws.run);
+    }
+    return stats;
+}
+
+void Scheduler::tickleIdle(size_t n){
+    //*调用者自己就是空闲线程时（比如IOManager的idle协程），它回到调度循环后会取走一个任务
+    Worker *self = currentWorker();
+    size_t idle = m_idleThreadCount;
+    if(self && self->idle){
+        --n;
+        --idle;
+    }
+    for(size_t i = std::min(n, idle); i > 0; --i)
+        tickle();
 }
 
 void Scheduler::idle(){
     LOG_DEBUG<<"idle";
+    Worker *self = currentWorker();
     while(!stopping()){
+        //*先在预算内自旋等任务，等不到再阻塞，由tickle唤醒
+        if(spinUntil([this](){ return hasReadyTask() || stopping(); })){
+            countIdle(SPIN_WIN);
+        }else{
+            countIdle(PARKED);
+            //*多余的线程空闲超时后退出
+            if(!park(self, retireTimeoutMs()) && tryRetire())
+                return;
+        }
         myconcurrent::Fiber::GetThis()->yield();
     }
+    //*唤醒其余阻塞的线程，让它们也能看到停止状态
+    for(auto &w : m_workers){
+        if(w.get() != self)
+            unpark(w.get());
+    }
 }
 
 void Scheduler::stop(){
@@ -90,15 +629,28 @@ void Scheduler::stop(){
     }
     m_stopping = true;
 
+    //*先停看门狗，之后不会再向退出中的工作线程发信号
+    {
+        MutexLockGuard lock(m_watchdogMutex);
+        m_watchdogStop = true;
+        m_watchdogCond.notify();
+    }
+    if(m_watchdog){
+        m_watchdog->join();
+        m_watchdog.reset();
+    }
+    if(m_holdsSignal){
+        m_holdsSignal = false;
+        ReleaseBacktraceSignal();
+    }
+
     if(m_useCaller){//*如果use_caller,那只能由caller线程发起stop
         assert(GetThis() == this);
     }else{
         assert(GetThis() != this);
     }
-    for(size_t i =0 ; i<m_threadCount;i++)
-        tickle();
-    if(m_rootFiber)
-        tickle();
+    for(size_t i = 0; i < m_workers.size(); i++)
+        tickleWorker(i);
     if(m_rootFiber){
         m_rootFiber->resume();
         LOG_DEBUG<<"m_rootFiber end";
@@ -109,9 +661,367 @@ void Scheduler::stop(){
         MutexLockGuard lock(m_mutex);
         thrs.swap(m_threads);
     }
+    //*弹性伸缩时没有用到的槽位是空的
     for(auto &i : thrs){
-        i->join();
+        if(i)
+            i->join();
+    }
+}
+
+Scheduler::StopReport Scheduler::stop(uint64_t timeout_ms){
+    StopReport report;
+    if(stopping())
+        return report;
+    m_draining = true;
+
+    //*到期由单独的线程取消剩余的等待，use_caller时调用线程要在stop()里执行调度协程
+    MutexLock mutex;
+    Condition cond(mutex);
+    bool done = false;
+    Thread deadline([&](){
+        t_stop_driver = true;
+        uint64_t end = NowNs() + timeout_ms * 1000 * 1000;
+        {
+            MutexLockGuard lock(mutex);
+            while(!done){
+                uint64_t now = NowNs();
+                if(now >= end)
+                    break;
+                cond.waitForMilliseconds((int64_t)((end - now) / (1000 * 1000)) + 1);
+            }
+            //*刚好在期限前停下来的不算超时
+            if(done || stopping())
+                return;
+        }
+        report.drained = false;
+        report.pendingTasks = m_taskCount + m_pinnedCount;
+        report.activeThreads = m_activeThreadCount;
+        onStopDeadline(report);
+        //*让阻塞在idle中的线程重新检查能否停止
+        for(size_t i = 0; i < m_workers.size(); i++)
+            tickleWorker(i);
+    }, m_name + "_stop");
+    deadline.start();
+
+    stop();
+
+    {
+        MutexLockGuard lock(mutex);
+        done = true;
+        cond.notify();
     }
+    deadline.join();
+    report.rejectedTasks = m_rejectedTasks;
+    if(!report.drained || report.rejectedTasks){
+        LOG_WARN<<"Scheduler "<<m_name<<" stop deadline "<<timeout_ms<<"ms drained="<<report.drained
+                <<" pendingTasks="<<report.pendingTasks<<" activeThreads="<<report.activeThreads
+                <<" cancelledEvents="<<report.cancelledEvents
+                <<" expiredTimers="<<report.expiredTimers<<" rejectedTasks="<<report.rejectedTasks;
+    }
+    return report;
+}
+
+size_t Scheduler::TaskQueue::size() const{
+    size_t n = 0;
+    for(auto &q : queues)
+        n += q.size();
+    return n;
+}
+
+bool Scheduler::TaskQueue::pop(ScheduleTask &task){
+    for(size_t tries = size(); tries > 0; --tries){
+        int level = -1;
+        //*低优先级被跳过太多次时先执行它
+        for(int p = PRIORITY_COUNT - 1; p > HIGH; --p){
+            if(!queues[p].empty() && skipped[p] >= kMaxSkipped){
+                level = p;
+                break;
+            }
+        }
+        for(int p = HIGH; level < 0 && p < PRIORITY_COUNT; ++p){
+            if(!queues[p].empty())
+                level = p;
+        }
+        if(level < 0)
+            return false;
+
+        RingQueue<ScheduleTask> &q = queues[level];
+        ScheduleTask &front = q.front();
+        //*协程把自己加入调度后还没来得及yield，先放回队尾
+        if(front.fiber && front.fiber->getState() == Fiber::RUNNING){
+            q.push_back(std::move(front));
+            q.pop_front();
+            continue;
+        }
+        task = std::move(front);
+        q.pop_front();
+        skipped[level] = 0;
+        for(int p = level + 1; p < PRIORITY_COUNT; ++p){
+            if(!queues[p].empty())
+                ++skipped[p];
+        }
+        return true;
+    }
+    return false;
+}
+
+void Scheduler::TaskQueue::takeAll(std::vector<ScheduleTask> &out){
+    for(auto &q : queues){
+        while(!q.empty()){
+            out.push_back(std::move(q.front()));
+            q.pop_front();
+        }
+    }
+}
+
+void Scheduler::TaskQueue::stealHalf(std::vector<ScheduleTask> &out){
+    for(auto &q : queues){
+        if(q.empty())
+            continue;
+        size_t count = (q.size() + 1) / 2;
+        while(count--){
+            out.push_back(std::move(q.back()));
+            q.pop_back();
+        }
+        return;
+    }
+}
+
+bool Scheduler::popMailbox(Worker *self, ScheduleTask &task){
+    if(self->pinned == 0)
+        return false;
+    MutexLockGuard lock(self->mailboxMutex);
+    if(!self->mailbox.pop(task))
+        return false;
+    --self->pinned;
+    --m_pinnedCount;
+    return true;
+}
+
+bool Scheduler::popLocal(Worker *self, ScheduleTask &task){
+    MutexLockGuard lock(self->mutex);
+    if(!self->local.pop(task))
+        return false;
+    --m_taskCount;
+    return true;
+}
+
+bool Scheduler::popGlobal(Worker *self, ScheduleTask &task, bool &tickle_me){
+    {
+        MutexLockGuard lock(m_mutex);
+        if(m_tasks.empty())
+            return false;
+
+        //*多取出的任务放进本地队列，减少全局锁的获取次数
+        ScheduleTask t;
+        while(self->stolen.size() < kGlobalBatch && m_tasks.pop(t))
+            self->stolen.push_back(std::move(t));
+        //*如果任务队列中还有任务，就tickle其他线程
+        tickle_me |= !m_tasks.empty();
+    }
+    if(self->stolen.empty())
+        return false;
+    task = std::move(self->stolen.front());
+    --m_taskCount;
+    if(self->stolen.size() > 1){
+        MutexLockGuard lock(self->mutex);
+        for(size_t i = 1; i < self->stolen.size(); ++i)
+            self->local.push(std::move(self->stolen[i]));
+    }
+    self->stolen.clear();
+    return true;
+}
+
+bool Scheduler::steal(Worker *self, ScheduleTask &task){
+    size_t n = m_workers.size();
+    if(n <= 1)
+        return false;
+    //*每个线程从不同的位置开始找，避免所有线程都去偷同一个队列
+    static thread_local size_t t_seed = myconcurrent::CurrentThread::tid();
+    t_seed = t_seed * 1103515245 + 12345;
+    size_t start = (t_seed >> 16) % n;
+    //*绑核时先偷同一个NUMA节点上的线程，再偷其他节点
+    for(size_t i = 0; i < 2 * n; ++i){
+        Worker *victim = m_workers[(start + i) % n].get();
+        if(victim == self || !victim->running)
+            continue;
+        if((i < n) != (victim->node == self->node))
+            continue;
+        {
+            MutexLockGuard lock(victim->mutex);
+            victim->local.stealHalf(self->stolen);
+        }
+        if(self->stolen.empty())
+            continue;
+        //*stolen里是从新到旧的顺序，最旧的一个直接执行，其余按原来的先后放入本地队列
+        Bump(self->stealOps, 1);
+        Bump(self->stolenTasks, self->stolen.size());
+        task = std::move(self->stolen.back());
+        self->stolen.pop_back();
+        --m_taskCount;
+        if(!self->stolen.empty()){
+            MutexLockGuard lock(self->mutex);
+            for(auto rit = self->stolen.rbegin(); rit != self->stolen.rend(); ++rit)
+                self->local.push(std::move(*rit));
+        }
+        self->stolen.clear();
+        return true;
+    }
+    return false;
+}
+
+void Scheduler::countRun(Worker *self, uint64_t start){
+    uint64_t ns = NowNs() - start;
+    self->runTime.record(ns);
+    Bump(self->busyNs, ns);
+    Bump(self->tasks, 1);
+}
+
+void Scheduler::beginRun(Worker *self, Fiber *fiber, uint64_t start){
+    self->preempt.store(false, std::memory_order_relaxed);
+    self->runFiberId.store(fiber->getId(), std::memory_order_relaxed);
+    Bump(self->runSeq, 1);
+    self->runStartNs.store(start, std::memory_order_release);
+}
+
+void Scheduler::yieldSlice(){
+    Fiber::ptr cur = Fiber::GetThis();
+    ScheduleTask task(cur, -1);
+    if(task.thread != -1){
+        //*共享栈协程回到自己线程的信箱
+        enqueue(task);
+    }else{
+        task.enqueueNs = NowNs();
+        {
+            MutexLockGuard lock(m_mutex);
+            ++m_taskCount;
+            m_tasks.push(std::move(task));
+        }
+        if(hasIdleThreads())
+            tickle();
+    }
+    //*还没切出去就被其他线程取到时，调度器会把它放回队尾
+    Fiber *raw_ptr = cur.get();
+    cur.reset();
+    raw_ptr->yield();
+}
+
+void Scheduler::setWatchdog(uint64_t budget_ms, uint64_t slice_ms){
+    m_budgetNs = budget_ms * 1000000;
+    m_sliceNs = slice_ms * 1000000;
+    if(!budget_ms && !slice_ms)
+        return;
+    MutexLockGuard lock(m_watchdogMutex);
+    if(m_watchdog || m_watchdogStop)
+        return;
+    AcquireBacktraceSignal();
+    m_holdsSignal = true;
+    m_watchdog.reset(new Thread(std::bind(&Scheduler::watchdog, this), m_name + "_watchdog"));
+    m_watchdog->start();
+}
+
+bool Scheduler::SetBacktraceSignal(int signo){
+    MutexLockGuard lock(s_signalMutex);
+    if(s_signalUsers > 0)
+        return false;
+    s_backtraceSignal = signo;
+    return true;
+}
+
+void Scheduler::AcquireBacktraceSignal(){
+    MutexLockGuard lock(s_signalMutex);
+    if(s_signalUsers++ > 0)
+        return;
+    if(s_backtraceSignal == 0)
+        s_backtraceSignal = SIGRTMIN + 2;
+    //*backtrace第一次调用时会加载libgcc，先在这里调用一次，信号处理函数里就不会再分配内存
+    void *frames[1];
+    backtrace(frames, 1);
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = &Scheduler::OnBacktraceSignal;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    if(sigaction(s_backtraceSignal, &sa, &s_oldAction) != 0){
+        LOG_ERROR<<"install watchdog signal "<<s_backtraceSignal<<" failed, errno = "<<errno;
+        assert(false);
+    }
+}
+
+void Scheduler::ReleaseBacktraceSignal(){
+    MutexLockGuard lock(s_signalMutex);
+    if(--s_signalUsers > 0)
+        return;
+    sigaction(s_backtraceSignal, &s_oldAction, nullptr);
+}
+
+void Scheduler::OnBacktraceSignal(int sig){
+    Worker *self = static_cast<Worker *>(t_worker);
+    if(!self){
+        //*不是发给工作线程的，交给原来的处理函数
+        if(!(s_oldAction.sa_flags & SA_SIGINFO) && s_oldAction.sa_handler != SIG_DFL
+           && s_oldAction.sa_handler != SIG_IGN)
+            s_oldAction.sa_handler(sig);
+        return;
+    }
+    int n = backtrace(self->frames, Worker::kMaxFrames);
+    self->frameSeq.store(self->runSeq.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    self->frameCount.store(n, std::memory_order_release);
+}
+
+void Scheduler::watchdog(){
+    MutexLockGuard lock(m_watchdogMutex);
+    while(!m_watchdogStop){
+        //*检查间隔取较小阈值的一半
+        uint64_t budget = m_budgetNs, slice = m_sliceNs;
+        uint64_t limit = budget && slice ? std::min(budget, slice) : budget + slice;
+        int64_t interval_ms = limit ? std::max<int64_t>(1, limit / 2000000) : 100;
+        m_watchdogCond.waitForMilliseconds(interval_ms);
+        if(m_watchdogStop)
+            break;
+        uint64_t now = NowNs();
+        for(auto &w : m_workers)
+            watchWorker(w.get(), now);
+    }
+}
+
+void Scheduler::watchWorker(Worker *w, uint64_t now){
+    uint64_t start = w->runStartNs.load(std::memory_order_acquire);
+    if(start == 0 || now < start)
+        return;
+    uint64_t elapsed = now - start;
+    uint64_t slice = m_sliceNs, budget = m_budgetNs;
+    if(slice && elapsed >= slice)
+        w->preempt.store(true, std::memory_order_relaxed);
+    uint64_t seq = w->runSeq.load(std::memory_order_relaxed);
+    if(!budget || elapsed < budget || w->reportedSeq == seq)
+        return;
+    w->reportedSeq = seq;
+    Bump(w->slowTasks, 1);
+    uint64_t fiber_id = w->runFiberId.load(std::memory_order_relaxed);
+
+    //*让工作线程自己抓调用栈；持有m_mutex保证线程不会在这期间被回收
+    w->frameCount.store(0, std::memory_order_relaxed);
+    {
+        MutexLockGuard lock(m_mutex);
+        if(!w->running || w->runSeq.load(std::memory_order_relaxed) != seq)
+            return;
+        pthread_kill(w->thread, s_backtraceSignal);
+    }
+    int n = 0;
+    for(int i = 0; i < 100 && (n = w->frameCount.load(std::memory_order_acquire)) == 0; ++i)
+        usleep(100);
+
+    LOG_WARN<<"Scheduler "<<m_name<<" worker "<<w->index<<" fiber "<<fiber_id
+            <<" has been running for "<<elapsed / 1000000<<"ms without yielding";
+    if(n <= 0 || w->frameSeq.load(std::memory_order_relaxed) != seq)
+        return;
+    char **symbols = backtrace_symbols(w->frames, n);
+    if(!symbols)
+        return;
+    for(int i = 0; i < n; ++i)
+        LOG_WARN<<"    #"<<i<<" "<<symbols[i];
+    free(symbols);
 }
 
 void Scheduler::run(){
@@ -124,69 +1034,150 @@ void Scheduler::run(){
    if(myconcurrent::CurrentThread::tid() != m_rootThread){
         t_scheduler_fiber = myconcurrent::Fiber::GetThis().get();
    }
+   Worker *self = currentWorker();
+   assert(self);
+   self->thread = pthread_self();
 
    Fiber::ptr idle_fiber(new Fiber(std::bind(&Scheduler::idle,this)));
-   Fiber::ptr cb_fiber;
 
    ScheduleTask task;
    while(true){
     task.reset();
     bool tickle_me = false; // 是否tickle其他线程进行任务调度
-    {
-        MutexLockGuard lock(m_mutex);
-        auto it = m_tasks.begin();
-        //遍历所有的调度任务
-        while(it != m_tasks.end()){
-            if(it->thread != -1 && it->thread != myconcurrent::CurrentThread::tid()){
-                //?指定了调度线程，但不是在当前线程上调度，标记一下需要通知其他线程进行调度，然后跳过这个任务，继续下一个
-                ++it;
-                tickle_me = true;
-                continue;;
-            }
-            assert(it->fiber || it->cb);
-            if(it->fiber && it->fiber->getState()== Fiber::RUNNING){
-                ++it;
-                continue;
-            }
-            //*当前调度线程找到一个任务，准备开始调度，将其从任务队列中剔除。活动线程加1
-            task = *it;
-            m_tasks.erase(it++);
-            ++m_activeThreadCount;
-            break;
-        }
-        //*如果任务队列中还有任务，就tickle其他线程
-        tickle_me |=(it != m_tasks.end());
+    //*先加活动线程数再出队，保证stopping()不会在任务出队和开始执行之间误判
+    ++m_activeThreadCount;
+    //*先取本线程的信箱和本地队列，再取全局注入队列，最后去其他线程偷取
+    bool found = popMailbox(self, task)
+              || popLocal(self, task)
+              || popGlobal(self, task, tickle_me)
+              || steal(self, task);
+    if(found){
+        tickle_me |= (m_taskCount > 0);
+    }else{
+        --m_activeThreadCount;
     }
-    if(tickle_me){
+    if(tickle_me && hasIdleThreads()){
         tickle();
     }
+    if(task.fiber && task.fiber->getState() == Fiber::RUNNING){
+        //*偷来的协程刚被加入调度、还没来得及切出去，重新入队稍后执行
+        enqueue(task);
+        --m_activeThreadCount;
+        continue;
+    }
+    uint64_t start = 0;
+    if(found){
+        start = NowNs();
+        uint64_t wait = start - task.enqueueNs;
+        self->queueWait.record(wait);
+        //*排队太久并且没有空闲线程，说明线程不够用
+        if(wait > m_growWaitNs && m_runningThreads < m_maxThreads && !hasIdleThreads())
+            grow();
+    }
     if(task.fiber){
         //* resume协程，resume返回时，协程要么执行完了，要么半路yield了，总之这个任务就算完成，活跃线程数减1
-        task.fiber->resume();
+        beginRun(self, task.fiber.get(), start);
+        Fiber::State state = task.fiber->resume();
+        self->runStartNs.store(0, std::memory_order_release);
         --m_activeThreadCount;
+        //*中途yield出去的回调协程在别的线程执行完时，也回到那个线程的池里
+        if(state == Fiber::TERM)
+            recycleFiber(self, task.fiber);
         task.reset();
+        countRun(self, start);
     }else if(task.cb){
+        //*池里栈大小和这个标签要的一样的协程才能复用，否则新建一个
+        size_t stacksize = Fiber::StackSizeFor(task.tag);
+        Fiber::ptr cb_fiber = takeFiber(self, stacksize);
         if(cb_fiber){
-            cb_fiber->reset(task.cb);
+            cb_fiber->reset(std::move(task.cb), task.tag);
         }else{
-            cb_fiber.reset(new Fiber(task.cb));
+            cb_fiber.reset(new Fiber(std::move(task.cb), stacksize, true, false, task.tag));
+            Bump(self->fiberCreates, 1);
         }
         task.reset();
+        beginRun(self, cb_fiber.get(), start);
+        Fiber::State state = cb_fiber->resume();
+        self->runStartNs.store(0, std::memory_order_release);
         --m_activeThreadCount;
-        cb_fiber.reset();
+        countRun(self, start);
+        //*半路yield的协程已经由别处持有，这里放手
+        if(state == Fiber::TERM)
+            recycleFiber(self, cb_fiber);
     }else{//进入这个分支情况一定时任务队列为空，调度idle协程即可
         if(idle_fiber->getState() == Fiber::TERM){
             LOG_DEBUG <<"idle fiber term";
             break;
         }
+        self->idle = true;
         ++m_idleThreadCount;
+        uint64_t idle_start = NowNs();
         idle_fiber->resume();
+        Bump(self->idleNs, NowNs() - idle_start);
         --m_idleThreadCount;
+        self->idle = false;
     }
 
    }
+   releaseFibers(self);
+   if(self->retiring)
+       retire(self);
    LOG_DEBUG<<"Scheduler::run() exit"; 
 }
 
+TaskGroup::TaskGroup(Scheduler *scheduler)
+    :m_scheduler(scheduler),
+     m_cond(m_mutex)
+{
+    if(!m_scheduler){
+        LOG_ERROR<<"TaskGroup without scheduler";
+        assert(false);
+    }
+}
+
+TaskGroup::~TaskGroup(){
+    wait();
+}
+
+void TaskGroup::done(){
+    if(m_pending.fetch_sub(1, std::memory_order_acq_rel) != 1)
+        return;
+    //*等待者已经放弃了自己的计数，正在等待唤醒，唤醒之后不能再访问任务组
+    if(m_waiter){
+        Scheduler *scheduler = m_waiterScheduler;
+        Fiber::ptr waiter = std::move(m_waiter);
+        scheduler->schedule(std::move(waiter));
+    }else{
+        MutexLockGuard lock(m_mutex);
+        m_done = true;
+        m_cond.notifyAll();
+    }
+}
+
+void TaskGroup::wait(){
+    //*没有任务时不需要等待，直接返回
+    if(m_pending.load(std::memory_order_acquire) == 1)
+        return;
+    bool in_fiber = Scheduler::InFiber();
+    if(in_fiber){
+        m_waiter = Fiber::GetThis();
+        m_waiterScheduler = Scheduler::GetThis();
+    }
+    //*放弃等待者的计数，减到0说明任务已经全部完成
+    if(m_pending.fetch_sub(1, std::memory_order_acq_rel) != 1){
+        if(in_fiber){
+            //*由最后一个完成的任务重新加入调度
+            Fiber::GetThis()->yield();
+        }else{
+            MutexLockGuard lock(m_mutex);
+            while(!m_done)
+                m_cond.wait();
+        }
+    }
+    m_waiter.reset();
+    m_waiterScheduler = nullptr;
+    m_done = false;
+    m_pending.store(1, std::memory_order_release);
+}
 
-}
\ No newline at end of file
+}//myconcurrent
@@ -1,14 +1,22 @@
 #pragma once
 #include <functional>
-#include <list>
+#include <vector>
 #include <memory>
 #include <string>
 #include <atomic>
+#include <chrono>
 #include "fiber.h"
+#include "inplace_task.h"
+#include "ring_queue.h"
 #include "Logging.h"
 #include "Thread.h"
+#include "Condition.h"
 
 namespace myconcurrent{
+
+template <class T>
+class Future;
+
 /*
     协程调度器
     封装的是N-M的协程的调度器，内部存在线程池
@@ -16,14 +24,31 @@ namespace myconcurrent{
 class Scheduler{
 public:
     typedef std::shared_ptr<Scheduler> ptr;
+
+    /**
+     * *任务优先级，每一级有单独的队列，总是先调度高优先级
+     * *低优先级被连续跳过一定次数后会插队执行一次，避免饿死
+     */
+    enum Priority{
+        //*延迟敏感的任务，IO事件唤醒的协程默认是这一级
+        HIGH = 0,
+        //*默认优先级
+        NORMAL,
+        //*后台任务，比如日志整理、缓存刷新
+        LOW,
+        PRIORITY_COUNT
+    };
     
     /*
         创建调度器
         threads 线程数
         use_caller是否将当前线程也作为调度器
         name 名称    
+        cpus 工作线程依次绑定的CPU，为空表示不绑核；caller线程不绑核
+        max_threads 线程数上限，大于threads时线程数在threads和max_threads之间随负载伸缩，0表示固定为threads
     */
-    Scheduler(size_t threads = 1, bool use_caller = true, const std::string &name ="Scheduler");
+    Scheduler(size_t threads = 1, bool use_caller = true, const std::string &name ="Scheduler",
+              const std::vector<int> &cpus = {}, size_t max_threads = 0);
 
     //析构函数
 
@@ -37,31 +62,241 @@ public:
 
     //获取当前线程的主协程
     static Fiber *GetMainFiber();
+
+    //当前进程可以使用的CPU列表，作为cpus传入即每个核一个工作线程
+    static std::vector<int> GetAvailableCpus();
+
+    //*当前是否运行在调度器调度的协程中，是的话等待时可以让出协程而不阻塞线程
+    static bool InFiber();
+
+    //*当前工作线程正在执行的任务是否已经用完时间片，由看门狗线程标记，Fiber::MaybeYield()使用
+    static bool SliceExpired();
+
+    //*当前协程让出时间片：排到全局注入队列的队尾再让出，本地队列和外部提交的任务都会先于它执行
+    void yieldSlice();
     /**
      * *模板实现增加复用性
      * *添加调度任务 
      * *任何类型为FiberOrcb，可以是协程对象或者是函数指针
+     * *回调按值转发到任务里，右值直接移动，只能移动的回调(如TaskFunc)需要std::move传入
      * *thread指定运行该任务的线程号， -1表示任何线程
+     * *priority任务优先级
+     * *tag是回调的入口标签(静态存储的字符串)，执行回调的协程按它统计栈用量、选择栈大小，见StackProfile
+     * *返回false表示任务没有入队：调度对象为空，或者限时停止中拒绝了外部提交的回调，这时回调已经被丢弃
     */
    template <class FiberOrCb>
-   void schedule(FiberOrCb fc, int thread = -1){
-        bool need_tickle = false;
+   bool schedule(FiberOrCb &&fc, int thread = -1, Priority priority = NORMAL, const char *tag = nullptr){
+        ScheduleTask task(std::forward<FiberOrCb>(fc), thread, priority);
+        task.tag = tag;
+        if(!task.fiber && !task.cb)//调度对象有回调函数或者协程
+            return false;
+        return enqueue(task); //*入队时按需唤醒idle协程
+   }
+
+    /**
+     * *批量添加调度任务，整批只加一次锁，最后按任务数唤醒需要的空闲线程
+     * *[begin, end)中的元素可以是协程、函数或者ScheduleTask，传入move_iterator可以避免拷贝
+     * *priority作用于协程和函数，ScheduleTask保留自己的优先级
+     */
+   template <class InputIterator>
+   void scheduleBatch(InputIterator begin, InputIterator end, Priority priority = NORMAL){
+        Worker *self = currentWorker();
+        bool reject = !self && rejectsExternal();
+        size_t n = 0;
+        uint64_t now = NowNs();
+        //*指定了线程的任务(共享栈协程)要投递到目标线程的信箱，解锁后逐个入队
+        std::vector<ScheduleTask> pinned;
         {
-            MutexLockGuard Mutex(m_mutex);
-            need_tickle = scheduleNoLock(fc,thread);
+            MutexLockGuard lock(self ? self->mutex : m_mutex);
+            TaskQueue &q = self ? self->local : m_tasks;
+            for(; begin != end; ++begin){
+                ScheduleTask task(*begin, -1, priority);
+                if(reject && !task.fiber){
+                    ++m_rejectedTasks;
+                    continue;
+                }
+                if(task.thread != -1){
+                    pinned.push_back(std::move(task));
+                    continue;
+                }
+                if(task.fiber || task.cb){
+                    task.enqueueNs = now;
+                    q.push(std::move(task));
+                    ++n;
+                }
+            }
+            //*出队要拿同一把锁，解锁之前加上计数，不会先被减掉
+            m_taskCount += n;
         }
-        if(need_tickle) // 唤醒idle协程
-            tickle();
+        for(auto &task : pinned)
+            enqueue(task);
+        if(n == 0)
+            return;
+        tickleIdle(n);
    }
+    /**
+     * *把[begin, end)按grain切块，分给各个工作线程执行fn(i)，返回时全部执行完
+     * *grain为0时按工作线程数自动切分；调用者自己执行第一块，然后等待其余块
+     * *在调度器的协程里调用时只让出当前协程，不阻塞工作线程
+     */
+    template <class Fn>
+    void parallelFor(size_t begin, size_t end, size_t grain, const Fn &fn);
+
+    /**
+     * *异步执行fn，返回的Future在fn执行完后就绪，fn抛出的异常在get()时重新抛出
+     * *定义在future.h中，使用时需要包含future.h
+     */
+    template <class Fn>
+    Future<typename std::decay<decltype(std::declval<Fn &>()())>::type>
+    async(Fn &&fn, Priority priority = NORMAL);
+
     //*启动调度器
     void start();
 
-    //*停止调度器
+    //*停止调度器，等所有任务、IO事件和定时器结束
     void stop();
+
+    //*限时停止的结果
+    struct StopReport{
+        //*期限内所有任务、IO事件和定时器都自然结束
+        bool drained = true;
+        //*期限到时还在排队的任务数
+        size_t pendingTasks = 0;
+        //*期限到时正在执行任务的工作线程数
+        size_t activeThreads = 0;
+        //*期限到时被取消的IO事件数
+        size_t cancelledEvents = 0;
+        //*期限到时被提前触发或丢弃的定时器数
+        size_t expiredTimers = 0;
+        //*停止期间被拒绝的外部任务数
+        size_t rejectedTasks = 0;
+    };
+
+    /**
+     * *限时停止：不再接受调度器以外的线程提交的新回调(唤醒协程不受影响)，执行中的任务有timeout_ms(毫秒)自然结束
+     * *到期后取消剩余的IO事件和定时器，等待它们的协程带着错误返回，再等队列中的任务执行完
+     * *返回到期时被取消的内容，没能在期限内结束时打印警告
+     * *和stop()一样停止后不能再start()，之后外部线程提交的回调一直被拒绝
+     */
+    StopReport stop(uint64_t timeout_ms);
+
+    /**
+     * *空闲策略的统计，用于判断自旋预算是否合适
+     */
+    struct IdleStats{
+        //*自旋期间等到了任务
+        uint64_t spinWins = 0;
+        //*自旋期间零超时的epoll_wait等到了IO事件或通知
+        uint64_t pollWins = 0;
+        //*自旋预算用完，阻塞等待
+        uint64_t parks = 0;
+    };
+
+    //*汇总所有工作线程的空闲统计
+    IdleStats getIdleStats() const;
+
+    /**
+     * *按2的幂分桶的耗时直方图(纳秒)，第i个桶统计[2^i, 2^(i+1))，0落在第0个桶
+     */
+    struct LatencyHistogram{
+        static const int kBuckets = 40;
+        uint64_t count = 0;
+        uint64_t sumNs = 0;
+        uint64_t buckets[kBuckets] = {};
+
+        void merge(const LatencyHistogram &other);
+        uint64_t meanNs() const { return count ? sumNs / count : 0; }
+        //*p分位(0~1)所在桶的上界，误差在2倍以内
+        uint64_t percentileNs(double p) const;
+    };
+
+    //*单个工作线程的运行统计
+    struct WorkerStats{
+        size_t index = 0;
+        //*执行任务(resume)的次数
+        uint64_t tasks = 0;
+        //*执行任务的时间
+        uint64_t busyNs = 0;
+        //*在idle协程中的时间
+        uint64_t idleNs = 0;
+        //*成功偷取的次数和偷到的任务数
+        uint64_t stealOps = 0;
+        uint64_t stolenTasks = 0;
+        //*本地队列和信箱中的任务数
+        size_t queueDepth = 0;
+        //*被看门狗报告执行超时的任务数
+        uint64_t slowTasks = 0;
+        //*为回调新建协程的次数，协程池命中时不增加
+        uint64_t fiberCreates = 0;
+        //*入队到开始执行的等待时间
+        LatencyHistogram queueWait;
+        //*每次resume的执行时间
+        LatencyHistogram run;
+    };
+
+    /**
+     * *调度器运行统计的快照
+     * *计数器只增不减，两次快照相减就是这段时间内的数据
+     */
+    struct Stats{
+        //*全局注入队列中的任务数
+        size_t globalQueueDepth = 0;
+        //*所有队列中还没执行的任务数
+        size_t queuedTasks = 0;
+        size_t activeThreads = 0;
+        size_t idleThreads = 0;
+        //*运行中的工作线程数，不含caller线程
+        size_t threads = 0;
+        //*所有工作线程合并后的直方图
+        LatencyHistogram queueWait;
+        LatencyHistogram run;
+        std::vector<WorkerStats> workers;
+    };
+
+    //*获取运行统计快照，计数器由各工作线程无锁记录，这里只在读队列长度时短暂加锁
+    Stats getStats();
+
+    //*空闲线程阻塞之前的自旋时间(微秒)，0表示直接阻塞；延迟敏感的服务可以用CPU换唤醒开销
+    void setIdleSpinUs(uint64_t us) { m_idleSpinUs = us; }
+    uint64_t getIdleSpinUs() const { return m_idleSpinUs; }
+
+    /**
+     * *弹性线程数，只在构造时max_threads大于threads时生效
+     * *任务排队超过growWaitUs(微秒)并且没有空闲线程时启动一个新的工作线程，直到max_threads
+     * *多出来的工作线程连续空闲retireIdleMs(毫秒)后退出，直到threads；stop()时不再伸缩
+     */
+    void setGrowWaitUs(uint64_t us) { m_growWaitNs = us * 1000; }
+    uint64_t getGrowWaitUs() const { return m_growWaitNs / 1000; }
+    void setRetireIdleMs(uint64_t ms) { m_retireIdleMs = ms; }
+    uint64_t getRetireIdleMs() const { return m_retireIdleMs; }
+
+    //*运行中的工作线程数，不含caller线程
+    size_t getThreadCount() const { return m_runningThreads; }
+
+    /**
+     * *协程执行时间看门狗
+     * *协程是协作式的，一个协程长时间不让出会卡住整个工作线程；后台线程定期检查各个工作线程当前任务的执行时间：
+     * *超过budget_ms的打印协程id和调用栈(每个任务只报告一次)，超过slice_ms的标记为时间片用完，Fiber::MaybeYield()据此让出
+     * *两者都为0时关闭；调用栈需要链接时加-rdynamic才有函数名
+     * *抓调用栈用SetBacktraceSignal()设置的信号，第一个看门狗启动时安装处理函数，最后一个停止时恢复原来的处理方式
+     */
+    void setWatchdog(uint64_t budget_ms, uint64_t slice_ms);
+
+    /**
+     * *看门狗让工作线程抓调用栈用的信号，默认SIGRTMIN+2
+     * *和程序自己用的信号冲突时在开启看门狗之前修改；已经有看门狗在运行时不能修改，返回false
+     */
+    static bool SetBacktraceSignal(int signo);
 protected:
     //*用于通知协程调度器工作
     virtual void tickle();
 
+    //*只通知指定的工作线程，默认退化为tickle()
+    virtual void tickleWorker(size_t idx);
+
+    //*新增了n个任务，唤醒至多n个空闲线程
+    void tickleIdle(size_t n);
+
     //*协程调度函数
     void run();
 
@@ -71,6 +306,12 @@ protected:
     //*返回是否可以停止
     virtual bool stopping();
 
+    //*限时停止到期时调用，取消还在等待的事件并记入传入的StopReport，调用之后会唤醒所有工作线程
+    virtual void onStopDeadline(StopReport &) {}
+
+    //*限时停止期间，调度器以外的线程提交的回调被拒绝
+    bool rejectsExternal() const;
+
     //*设置当前协程调度器
     void setThis();
 
@@ -79,35 +320,105 @@ protected:
      * * 当调度协程进入idle时空闲线程数加1，从idle协程返回时空闲线程数减1
      */
     bool hasIdleThreads() { return m_idleThreadCount > 0; }
-private:
-    template <class FiberOrcb>
-    bool scheduleNoLock(FiberOrcb fc,int thread){
-        bool need_tickle = m_tasks.empty();
-        ScheduleTask task(fc, thread);
-        if(task.fiber || task.cb)/调度对象有回调函数或者协程
-            m_tasks.push_back(task);
-        return need_tickle; 
-    }   
 
-private:
+    //*当前线程在调度器中的工作线程序号，不是本调度器的线程返回-1
+    int getWorkerIndex() const;
+
+    //*工作线程总数，use_caller时包括caller线程
+    size_t getWorkerCount() const { return m_workers.size(); }
+
+    //*指定的工作线程是否处于idle中
+    bool isWorkerIdle(size_t idx) const { return m_workers[idx]->idle; }
+
+    //*当前线程是否有能执行的任务，idle在阻塞等待之前用来复查，避免丢失通知
+    bool hasReadyTask() const;
+
+    //*一次空闲等待的结果
+    enum IdleResult{
+        SPIN_WIN = 0,
+        POLL_WIN,
+        PARKED
+    };
+
+    //*记录当前工作线程的一次空闲等待结果
+    void countIdle(IdleResult result);
+
+    //*当前工作线程空闲阻塞的超时时间(毫秒)，超时后可以尝试退出；0表示不能退出，一直阻塞
+    uint64_t retireTimeoutMs() const;
+
+    /**
+     * *当前工作线程空闲超时后尝试退出，线程数已经降到下限、正在停止或者还有任务时返回false
+     * *返回true时idle协程应当直接返回，run()取完剩余的任务后线程退出
+     */
+    bool tryRetire();
+
+    //*在自旋预算内反复检查pred，pred返回true则返回true；预算为0时直接返回false
+    template <class Pred>
+    bool spinUntil(Pred pred){
+        uint64_t budget = m_idleSpinUs;
+        if(budget == 0)
+            return false;
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(budget);
+        do{
+            for(int i = 0; i < 64; ++i){
+                if(pred())
+                    return true;
+                CpuRelax();
+            }
+        }while(std::chrono::steady_clock::now() < deadline);
+        return false;
+    }
+
+    //*单调时钟(纳秒)，用于运行统计
+    static inline uint64_t NowNs(){
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    //*自旋等待时降低功耗、让出流水线
+    static inline void CpuRelax(){
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#elif defined(__aarch64__)
+        asm volatile("yield");
+#endif
+    }
 
     struct ScheduleTask{
         Fiber::ptr fiber;
-        std::function<void()> cb;
+        //*64字节以内的回调直接存放在任务里，入队出队不分配内存
+        TaskFunc cb;
         int thread;
+        Priority priority = NORMAL;
+        //*入队时间(纳秒)，用于统计排队等待时间
+        uint64_t enqueueNs = 0;
+        //*回调的入口标签
+        const char *tag = nullptr;
 
-        ScheduleTask(Fiber::ptr f, int thr){
-            fiber = f;
-            thread = thr;
+        //*共享栈协程只能回到绑定的线程上执行
+        ScheduleTask(Fiber::ptr f, int thr, Priority prio = NORMAL){
+            fiber = std::move(f);
+            thread = thr == -1 && fiber ? fiber->getBoundThread() : thr;
+            priority = prio;
         }
-        ScheduleTask(Fiber::ptr *f, int thr){
+        ScheduleTask(Fiber::ptr *f, int thr, Priority prio = NORMAL){
             fiber.swap(*f);
-            thread = thr;
+            thread = thr == -1 && fiber ? fiber->getBoundThread() : thr;
+            priority = prio;
         }
 
-        ScheduleTask(std::function<void()> f, int thr){
-            cb = f;
+        ScheduleTask(TaskFunc f, int thr, Priority prio = NORMAL){
+            cb = std::move(f);
             thread = thr;
+            priority = prio;
+        }
+        //*用于批量调度时直接传入已经构造好的任务，保留原来的优先级和指定的线程
+        ScheduleTask(ScheduleTask &&t, int thr, Priority = NORMAL){
+            fiber = std::move(t.fiber);
+            cb = std::move(t.cb);
+            thread = thr == -1 ? t.thread : thr;
+            priority = t.priority;
+            tag = t.tag;
         }
         ScheduleTask(){thread = -1;}
 
@@ -115,8 +426,186 @@ private:
             fiber = nullptr;
             cb =nullptr;
             thread = -1;
+            priority = NORMAL;
+            enqueueNs = 0;
+            tag = nullptr;
         }
     };
+private:
+
+    /**
+     * *按优先级分级的任务队列，不带锁，由使用者加锁
+     */
+    struct TaskQueue{
+        RingQueue<ScheduleTask> queues[PRIORITY_COUNT];
+        //*每一级在有任务的情况下被连续跳过的次数
+        uint32_t skipped[PRIORITY_COUNT] = {0};
+
+        size_t size() const;
+        bool empty() const { return size() == 0; }
+        void push(ScheduleTask &&task) { queues[task.priority].push_back(std::move(task)); }
+        //*按优先级从头部出队
+        bool pop(ScheduleTask &task);
+        //*取出全部任务，包括还没切出去的协程
+        void takeAll(std::vector<ScheduleTask> &out);
+        //*从最高的非空优先级尾部取出一半，按从新到旧的顺序放入out
+        void stealHalf(std::vector<ScheduleTask> &out);
+    };
+
+    /**
+     * *LatencyHistogram的记录端，只有所属工作线程写入，其他线程可以随时读取快照
+     */
+    struct AtomicHistogram{
+        std::atomic<uint64_t> count{0};
+        std::atomic<uint64_t> sumNs{0};
+        std::atomic<uint64_t> buckets[LatencyHistogram::kBuckets];
+
+        AtomicHistogram();
+        void record(uint64_t ns);
+        void load(LatencyHistogram &out) const;
+    };
+
+    //*单一写者的计数器，不需要带lock前缀的原子加
+    static inline void Bump(std::atomic<uint64_t> &c, uint64_t v){
+        c.store(c.load(std::memory_order_relaxed) + v, std::memory_order_relaxed);
+    }
+
+    /**
+     * *工作线程的本地任务队列
+     * *本线程提交的任务放入自己的队列尾部，也从头部按FIFO取出；空闲的线程从其他线程队列的尾部偷取一半任务
+     * *每个队列一把锁，正常情况下只有所属线程会访问，不再和其他线程争用调度器的全局锁
+     */
+    struct Worker{
+        MutexLock mutex;
+        TaskQueue local;
+        //*批量取全局任务或偷取任务时的临时缓冲，只有所属线程访问
+        std::vector<ScheduleTask> stolen;
+        //*执行完的协程，给之后的回调reset()复用，只有所属线程访问
+        std::vector<Fiber::ptr> fiberPool;
+
+        //*指定在本线程执行的任务，只有本线程会取，不会被偷
+        MutexLock mailboxMutex;
+        TaskQueue mailbox;
+        std::atomic<size_t> pinned = {0};
+
+        //*工作线程序号
+        size_t index = 0;
+        //*所属线程的id，线程没有运行时为0，mailboxMutex保护写入
+        std::atomic<int> tid = {0};
+        //*槽位上是否有线程在运行，线程退出时最后才清除
+        std::atomic<bool> running = {false};
+        //*空闲超时，run()取完任务后退出
+        bool retiring = false;
+        //*绑定的CPU所在的NUMA节点，-1表示未绑核
+        int node = -1;
+        //*是否处于idle中
+        std::atomic<bool> idle = {false};
+
+        //*Scheduler::idle阻塞等待用的条件变量，notified在parkMutex保护下
+        MutexLock parkMutex;
+        Condition parkCond;
+        bool notified = false;
+        std::atomic<bool> parked = {false};
+
+        //*按IdleResult统计的空闲等待次数
+        std::atomic<uint64_t> idleCounts[PARKED + 1] = {};
+
+        //*当前任务开始执行的时间，0表示没有在执行任务；和下面几项一起由看门狗读取
+        std::atomic<uint64_t> runStartNs = {0};
+        std::atomic<uint64_t> runFiberId = {0};
+        //*每执行一个任务加1，用来区分看门狗两次看到的是不是同一个任务
+        std::atomic<uint64_t> runSeq = {0};
+        //*当前任务时间片用完
+        std::atomic<bool> preempt = {false};
+        pthread_t thread;
+        //*信号处理函数抓取的调用栈，frameSeq是抓取时的runSeq
+        static const int kMaxFrames = 32;
+        void *frames[kMaxFrames];
+        std::atomic<int> frameCount = {0};
+        std::atomic<uint64_t> frameSeq = {0};
+        //*看门狗已经报告过的任务，只有看门狗线程访问
+        uint64_t reportedSeq = 0;
+        std::atomic<uint64_t> slowTasks = {0};
+
+        //*运行统计，只有所属线程写
+        std::atomic<uint64_t> tasks = {0};
+        std::atomic<uint64_t> busyNs = {0};
+        std::atomic<uint64_t> idleNs = {0};
+        std::atomic<uint64_t> stealOps = {0};
+        std::atomic<uint64_t> stolenTasks = {0};
+        std::atomic<uint64_t> fiberCreates = {0};
+        AtomicHistogram queueWait;
+        AtomicHistogram runTime;
+
+        Worker() : parkCond(parkMutex) {}
+    };
+
+    //*阻塞当前工作线程直到被unpark，timeout_ms不为0时超时返回false
+    bool park(Worker *self, uint64_t timeout_ms = 0);
+
+    //*唤醒阻塞的工作线程
+    void unpark(Worker *w);
+
+    //*任务入队，调度器内部线程放入本地队列，外部线程放入全局注入队列；被拒绝时返回false
+    bool enqueue(ScheduleTask &task);
+
+    //*返回当前线程对应的工作队列，不是本调度器的线程则返回nullptr
+    Worker *currentWorker() const;
+
+    //*根据线程id找到对应的工作线程
+    Worker *findWorker(int tid) const;
+
+    //*从本线程的信箱取指定在本线程执行的任务
+    bool popMailbox(Worker *self, ScheduleTask &task);
+
+    //*从本地队列取任务
+    bool popLocal(Worker *self, ScheduleTask &task);
+
+    //*从全局注入队列取任务，顺带搬一批到本地队列
+    bool popGlobal(Worker *self, ScheduleTask &task, bool &tickle_me);
+
+    //*从其他线程的本地队列尾部偷取任务
+    bool steal(Worker *self, ScheduleTask &task);
+
+    //*记录一次从start开始的任务执行
+    void countRun(Worker *self, uint64_t start);
+
+    //*在第i个槽位上启动工作线程，调用前持有m_mutex
+    bool spawnWorker(size_t i);
+
+    //*排队时间过长时增加一个工作线程
+    void grow();
+
+    //*空闲超时的工作线程退出前，把信箱和本地队列中剩余的任务转到全局注入队列
+    void retire(Worker *self);
+
+    //*记录当前工作线程开始执行fiber
+    void beginRun(Worker *self, Fiber *fiber, uint64_t start);
+
+    /**
+     * *回调协程池：每个工作线程缓存执行完的协程，回调直接reset()复用，不再分配协程对象和栈
+     * *协程在哪个线程执行完就回到哪个线程的池；超过高水位时降到低水位，多出来的放进全局池，
+     * *本线程的池里没有合适的协程时先从全局池取回一批，这样线程之间的不平衡会通过全局池拉平
+     */
+    //*取一个栈大小为stacksize的协程，没有时返回nullptr
+    Fiber::ptr takeFiber(Worker *self, size_t stacksize);
+    //*执行完的协程放回池里；共享栈协程或者别处还持有的协程不回收
+    void recycleFiber(Worker *self, Fiber::ptr &fiber);
+    //*工作线程退出时把池里的协程交给全局池
+    void releaseFibers(Worker *self);
+
+    //*看门狗线程
+    void watchdog();
+
+    //*检查一个工作线程当前任务的执行时间
+    void watchWorker(Worker *w, uint64_t now);
+
+    //*看门狗让超时的工作线程在信号处理函数中抓取自己的调用栈
+    static void OnBacktraceSignal(int sig);
+
+    //*看门狗启动、停止时调用，按引用计数安装和恢复信号处理函数
+    static void AcquireBacktraceSignal();
+    static void ReleaseBacktraceSignal();
 
 
 
@@ -124,19 +613,37 @@ private:
     //*调度器名称
     std::string m_name;
 
-    //互斥锁
+    //互斥锁，只保护全局注入队列和线程池
     MutexLock m_mutex;
 
     //线程池；
     std::vector<Thread::ptr> m_threads;
 
-    //任务队列
-    std::list<ScheduleTask> m_tasks;
-    //记录线程的ID的数组
+    //全局注入队列，非调度线程提交的任务
+    TaskQueue m_tasks;
+    //每个调度线程一个本地队列，use_caller时最后一个属于caller线程
+    std::vector<std::unique_ptr<Worker>> m_workers;
+    //本地队列和全局队列中等待调度的任务数，不含信箱中的任务
+    std::atomic<size_t> m_taskCount = {0};
+    //所有信箱中等待调度的任务数
+    std::atomic<size_t> m_pinnedCount = {0};
+    //记录线程的ID的数组，m_mutex保护
     std::vector<int> m_threadIds;
     
-    //工作线程数量
+    //工作线程数量，弹性伸缩时是下限
     size_t m_threadCount = 0;
+    //工作线程数上限，槽位按上限预先分配
+    size_t m_maxThreads = 0;
+    //运行中的工作线程数
+    std::atomic<size_t> m_runningThreads = {0};
+    //是否有线程正在增加工作线程
+    std::atomic<bool> m_growing = {false};
+    //排队超过这个时间(纳秒)时增加工作线程
+    std::atomic<uint64_t> m_growWaitNs = {1000 * 1000};
+    //空闲超过这个时间(毫秒)的多余线程退出
+    std::atomic<uint64_t> m_retireIdleMs = {3000};
+    //工作线程绑定的CPU
+    std::vector<int> m_cpus;
     //活跃的线程数
     std::atomic<size_t> m_activeThreadCount = {0};
 
@@ -150,9 +657,127 @@ private:
     //user_caller 为true时，调度器所在线程的id
     int m_rootThread=0;
 
-    //是否停止
-    bool m_stopping = false;
+    //是否停止，stop()不持锁写入，grow()等在m_mutex内读取
+    std::atomic<bool> m_stopping = {false};
+    //限时停止中，拒绝外部提交的新回调；停止后的调度器不能重新启动，不再清除
+    std::atomic<bool> m_draining = {false};
+    std::atomic<size_t> m_rejectedTasks = {0};
+
+    //空闲线程阻塞前的自旋时间(微秒)
+    std::atomic<uint64_t> m_idleSpinUs = {0};
+
+    //全局协程池，工作线程之间平衡用
+    MutexLock m_fiberPoolMutex;
+    std::vector<Fiber::ptr> m_fiberPool;
+
+    //看门狗：报告超时的阈值和时间片(纳秒)，0表示关闭
+    std::atomic<uint64_t> m_budgetNs = {0};
+    std::atomic<uint64_t> m_sliceNs = {0};
+    Thread::ptr m_watchdog;
+    MutexLock m_watchdogMutex;
+    Condition m_watchdogCond;
+    bool m_watchdogStop = false;
+    //*看门狗线程在运行，持有信号处理函数的一个引用
+    bool m_holdsSignal = false;
 };//
 
+/**
+ * *fork/join任务组：run()提交的任务分散到调度器的各个工作线程执行，wait()等待全部完成
+ * *在调度器的协程里wait()只让出当前协程，最后一个完成的任务把它重新加入调度；在其他线程里wait()阻塞等待
+ * *同一时间只能有一个等待者，wait()返回后可以继续复用
+ */
+class TaskGroup{
+public:
+    explicit TaskGroup(Scheduler *scheduler = Scheduler::GetThis());
+
+    //*析构时等待还没完成的任务
+    ~TaskGroup();
+
+    TaskGroup(const TaskGroup &) = delete;
+    TaskGroup &operator=(const TaskGroup &) = delete;
+
+    /**
+     * *提交一个任务
+     * *调度器拒绝时(限时停止中从外部线程提交)撤销计数并返回false，任务不会执行，wait()不会因为它卡住
+     */
+    template <class Fn>
+    bool run(Fn &&fn, Scheduler::Priority priority = Scheduler::NORMAL){
+        m_pending.fetch_add(1, std::memory_order_relaxed);
+        m_unfinished.fetch_add(1, std::memory_order_relaxed);
+        if(m_scheduler->schedule(Task<typename std::decay<Fn>::type>{this, std::forward<Fn>(fn)}, -1, priority))
+            return true;
+        m_unfinished.fetch_sub(1, std::memory_order_release);
+        done();
+        return false;
+    }
+
+    //*等待已提交的任务全部完成
+    void wait();
+
+    //*还没完成的任务数
+    size_t pending() const { return m_unfinished.load(std::memory_order_acquire); }
+
+private:
+    //*包装任务，执行完通知任务组
+    template <class Fn>
+    struct Task{
+        TaskGroup *group;
+        Fn fn;
+        void operator()(){
+            fn();
+            group->m_unfinished.fetch_sub(1, std::memory_order_release);
+            group->done();
+        }
+    };
+
+    //*一个任务完成，最后一个完成的唤醒等待者
+    void done();
+
+private:
+    Scheduler *m_scheduler;
+    //*未完成的任务数加上等待者持有的1，减到0的一方负责唤醒
+    std::atomic<size_t> m_pending = {1};
+    //*未完成的任务数，不含等待者的计数，只用于pending()；m_pending在wait()期间少了等待者的1，不能直接减1返回
+    std::atomic<size_t> m_unfinished = {0};
+    //*在协程中等待时，等待的协程和它所在的调度器
+    Fiber::ptr m_waiter;
+    Scheduler *m_waiterScheduler = nullptr;
+    //*在线程中等待时使用
+    MutexLock m_mutex;
+    Condition m_cond;
+    bool m_done = false;
+};
+
+template <class Fn>
+void Scheduler::parallelFor(size_t begin, size_t end, size_t grain, const Fn &fn){
+    if(begin >= end)
+        return;
+    size_t n = end - begin;
+    if(grain == 0){
+        //*每个工作线程大约分到4块，给偷取留出均衡的余地
+        grain = n / (getWorkerCount() * 4);
+        if(grain == 0)
+            grain = 1;
+    }
+    size_t chunks = n / grain + (n % grain != 0);
+    const Fn *f = &fn;
+    TaskGroup group(this);
+    for(size_t c = 1; c < chunks; ++c){
+        size_t lo = begin + c * grain;
+        size_t hi = end - lo > grain ? lo + grain : end;
+        auto chunk = [f, lo, hi](){
+            for(size_t i = lo; i < hi; ++i)
+                (*f)(i);
+        };
+        //*调度器拒绝时由调用者自己执行这一块
+        if(!group.run(chunk))
+            chunk();
+    }
+    size_t hi = n > grain ? begin + grain : end;
+    for(size_t i = begin; i < hi; ++i)
+        fn(i);
+    group.wait();
+}
+
 
 }//myconcurrent
\ No newline at end of file
@@ -0,0 +1,152 @@
+#include "sharded_iomanager.h"
+#include <unistd.h>
+#include "CountDownLatch.h"
+
+namespace myconcurrent{
+
+//*当前线程所属的分片调度器和分片序号
+static thread_local ShardedIOManager *t_sharded = nullptr;
+static thread_local int t_shard = -1;
+
+ShardedIOManager::ShardedIOManager(size_t shards, const std::string &name, bool pin,
+                                   size_t mailbox_capacity)
+    :m_name(name)
+{
+    std::vector<int> cpus = Scheduler::GetAvailableCpus();
+    if(shards == 0)
+        shards = cpus.empty() ? 1 : cpus.size();
+    for(size_t i = 0; i < shards; ++i){
+        std::vector<int> shard_cpus;
+        if(pin && !cpus.empty())
+            shard_cpus.push_back(cpus[i % cpus.size()]);
+        std::unique_ptr<Shard> shard(new Shard);
+        shard->io.reset(new IOManager(1, false, name + "_" + std::to_string(i), shard_cpus));
+        m_shards.push_back(std::move(shard));
+    }
+    m_mesh.resize(shards * shards);
+    for(size_t from = 0; from < shards; ++from){
+        for(size_t to = 0; to < shards; ++to){
+            if(from != to)
+                m_mesh[from * shards + to].reset(new Mailbox(mailbox_capacity));
+        }
+    }
+
+    //*让每个分片线程记住自己的序号
+    CountDownLatch latch(shards);
+    for(size_t i = 0; i < shards; ++i){
+        m_shards[i]->io->schedule([this, i, &latch](){
+            t_sharded = this;
+            t_shard = (int)i;
+            latch.countDown();
+        });
+    }
+    latch.wait();
+}
+
+ShardedIOManager::~ShardedIOManager(){
+    stop();
+}
+
+int ShardedIOManager::currentShard() const{
+    return t_sharded == this ? t_shard : -1;
+}
+
+bool ShardedIOManager::submitTo(size_t shard, TaskFunc fn){
+    assert(shard < m_shards.size());
+    Shard &target = *m_shards[shard];
+    if(m_closing.load(std::memory_order_acquire)){
+        LOG_ERROR<<"ShardedIOManager "<<m_name<<" submit to shard "<<shard<<" while stopping";
+        return false;
+    }
+    int from = currentShard();
+    if(from < 0 || (size_t)from == shard)
+        return target.io->schedule(std::move(fn));
+    Mailbox &box = mailbox(from, shard);
+    while(!box.push(fn)){
+        if(!Scheduler::InFiber()){
+            //*没法等，直接投递到目标分片的全局队列，这条消息不再保证顺序
+            return target.io->schedule(std::move(fn));
+        }
+        //*让出时间片，本分片趁机处理别人发来的消息，避免两个分片互相等待
+        notify(shard);
+        Scheduler::GetThis()->yieldSlice();
+    }
+    notify(shard);
+    return true;
+}
+
+void ShardedIOManager::notify(size_t to){
+    Shard &target = *m_shards[to];
+    //*和drain()中先清标记再取消息配对：入队和读标记之间、清标记和取消息之间都要有全屏障，否则两边可能都看不到对方
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(target.pending.load(std::memory_order_relaxed))
+        return;
+    if(target.pending.exchange(true, std::memory_order_acq_rel))
+        return;
+    target.io->schedule([this, to](){ drain(to); });
+}
+
+void ShardedIOManager::drain(size_t to){
+    Shard &self = *m_shards[to];
+    self.pending.store(false, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    TaskFunc fn;
+    for(size_t from = 0; from < m_shards.size(); ++from){
+        if(from == to)
+            continue;
+        Mailbox &box = mailbox(from, to);
+        while(box.pop(fn))
+            self.batch.push_back(std::move(fn));
+    }
+    if(self.batch.empty())
+        return;
+    //*消息各自作为一个任务执行，其中等待IO的不会挡住后面的消息
+    self.io->scheduleBatch(std::make_move_iterator(self.batch.begin()),
+                           std::make_move_iterator(self.batch.end()));
+    self.batch.clear();
+}
+
+bool ShardedIOManager::quiescent(){
+    for(auto &box : m_mesh){
+        if(box && !box->empty())
+            return false;
+    }
+    for(auto &shard : m_shards){
+        if(shard->pending.load(std::memory_order_acquire))
+            return false;
+        Scheduler::Stats stats = shard->io->getStats();
+        if(stats.queuedTasks > 0 || stats.activeThreads > 0)
+            return false;
+        //*等IO事件和定时器的协程醒来后还可能发消息
+        if(shard->io->getPendingEventCount() > 0 || shard->io->hasTimer())
+            return false;
+    }
+    return true;
+}
+
+void ShardedIOManager::waitQuiescent(){
+    int quiet = 0;
+    while(quiet < 2){
+        quiet = quiescent() ? quiet + 1 : 0;
+        if(quiet < 2)
+            usleep(1000);
+    }
+}
+
+void ShardedIOManager::stop(){
+    if(m_stopped)
+        return;
+    if(currentShard() >= 0){
+        LOG_ERROR<<"ShardedIOManager "<<m_name<<" stop in shard thread";
+        assert(false);
+    }
+    m_stopped = true;
+    waitQuiescent();
+    //*所有分片同时停止接受消息，关闭前检查通过的发送者可能还在入队，再等一次
+    m_closing.store(true, std::memory_order_release);
+    waitQuiescent();
+    for(auto &shard : m_shards)
+        shard->io->stop();
+}
+
+}//myconcurrent
@@ -0,0 +1,101 @@
+#pragma once
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include "iomanager.h"
+#include "spsc_queue.h"
+
+namespace myconcurrent{
+
+/**
+ * *无共享的分片IO调度器
+ * *IOManager所有线程共用一个epoll和全局任务队列，QPS很高时跨核访问这些共享结构的开销占了大头
+ * *这里每个分片是一个单线程的IOManager，绑在一个核上，有自己的epoll、定时器和任务队列，分片之间不共享数据
+ * *分片之间通过submitTo()发消息：每对分片之间一个SPSC无锁环形队列，目标分片一次取走一批放进自己的本地队列
+ * *同一个发送分片发往同一个目标分片的消息按发送顺序执行
+ * *连接归属于shardOf(fd)分片，在这个连接的整个生命周期内，它的addEvent和读写都只能在所属分片上进行
+ */
+class ShardedIOManager : noncopyable{
+public:
+    typedef std::shared_ptr<ShardedIOManager> ptr;
+
+    /**
+     * *shards 分片数，0表示每个可用的CPU一个分片
+     * *name 名称，分片线程名为name_序号
+     * *pin 是否把第i个分片绑在第i个可用的CPU上
+     * *mailbox_capacity 每对分片之间消息队列的容量
+     */
+    ShardedIOManager(size_t shards = 0, const std::string &name = "Shard", bool pin = true,
+                     size_t mailbox_capacity = 1024);
+
+    ~ShardedIOManager();
+
+    size_t size() const { return m_shards.size(); }
+
+    IOManager *shard(size_t idx) const { return m_shards[idx]->io.get(); }
+
+    //*当前线程所在的分片序号，不是本调度器的分片线程返回-1
+    int currentShard() const;
+
+    //*fd所属的分片
+    size_t shardOf(int fd) const { return (size_t)fd % m_shards.size(); }
+
+    /**
+     * *在指定分片上执行fn
+     * *从分片线程调用时走SPSC队列，队列满时在协程中让出等目标分片取走，不在协程中则退化为schedule；
+     * *从其他线程调用时直接schedule到目标分片
+     * *stop()开始关闭之后不再接受，返回false，fn不会执行
+     */
+    bool submitTo(size_t shard, TaskFunc fn);
+
+    //*把fd交给所属分片处理
+    bool dispatch(int fd, TaskFunc fn) { return submitTo(shardOf(fd), std::move(fn)); }
+
+    /**
+     * *先等所有分片安静下来：跨分片消息都送达并执行完，没有排队的任务、等待中的IO事件和定时器；
+     * *然后所有分片同时停止接受新消息，再等一次把关闭前已经发出的消息执行完，最后依次停止各个分片
+     * *这样不会有消息发往已经停止的分片；关闭之后的submitTo()返回false
+     * *不能在分片线程中调用
+     */
+    void stop();
+
+private:
+    typedef SpscQueue<TaskFunc> Mailbox;
+
+    struct Shard{
+        IOManager::ptr io;
+        //*是否已经安排了drain，多个发送分片共享，单独占一个缓存行
+        char pad0[64];
+        std::atomic<bool> pending = {false};
+        char pad1[64];
+        //*drain时的临时缓冲，只有本分片线程访问
+        std::vector<TaskFunc> batch;
+    };
+
+    //*from发往to的队列
+    Mailbox &mailbox(size_t from, size_t to) { return *m_mesh[from * m_shards.size() + to]; }
+
+    //*通知目标分片取消息，已经通知过还没取的不再重复通知
+    void notify(size_t to);
+
+    //*在目标分片上运行，取走所有发给它的消息放进本地队列
+    void drain(size_t to);
+
+    //*所有消息队列为空、所有分片没有任务在排队和执行，也没有还会触发的IO事件和定时器
+    bool quiescent();
+
+    //*连续两次检查都安静才返回，消息在队列、drain和本地队列之间转移时总有一处能看到
+    void waitQuiescent();
+
+private:
+    std::string m_name;
+    std::vector<std::unique_ptr<Shard>> m_shards;
+    //*N*N个队列，对角线上为空
+    std::vector<std::unique_ptr<Mailbox>> m_mesh;
+    bool m_stopped = false;
+    //*stop()已经开始关闭，拒绝新消息
+    std::atomic<bool> m_closing = {false};
+};
+
+}//myconcurrent
@@ -0,0 +1,85 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <new>
+#include <utility>
+#include "noncopyable.h"
+
+namespace myconcurrent{
+
+/**
+ * *单生产者单消费者的无锁环形队列，容量固定为2的幂
+ * *生产者只写m_tail，消费者只写m_head，各自缓存对方的位置，只有缓存显示满/空时才去读对方的缓存行
+ */
+template <class T>
+class SpscQueue : noncopyable{
+public:
+    explicit SpscQueue(size_t capacity){
+        size_t cap = 2;
+        while(cap < capacity)
+            cap <<= 1;
+        m_mask = cap - 1;
+        m_slots = static_cast<T *>(::operator new(cap * sizeof(T)));
+    }
+
+    ~SpscQueue(){
+        size_t head = m_head.load(std::memory_order_relaxed);
+        size_t tail = m_tail.load(std::memory_order_relaxed);
+        for(; head != tail; ++head)
+            m_slots[head & m_mask].~T();
+        ::operator delete(m_slots);
+    }
+
+    //*只能由生产者调用；队列满时返回false，value保持不变
+    bool push(T &value){
+        size_t tail = m_tail.load(std::memory_order_relaxed);
+        if(tail - m_cachedHead > m_mask){
+            m_cachedHead = m_head.load(std::memory_order_acquire);
+            if(tail - m_cachedHead > m_mask)
+                return false;
+        }
+        new (&m_slots[tail & m_mask]) T(std::move(value));
+        m_tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    //*只能由消费者调用；队列空时返回false
+    bool pop(T &out){
+        size_t head = m_head.load(std::memory_order_relaxed);
+        if(head == m_cachedTail){
+            m_cachedTail = m_tail.load(std::memory_order_acquire);
+            if(head == m_cachedTail)
+                return false;
+        }
+        T &slot = m_slots[head & m_mask];
+        out = std::move(slot);
+        slot.~T();
+        m_head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    //*任何线程都可以调用，结果只是一个瞬间的快照
+    bool empty() const{
+        return m_head.load(std::memory_order_acquire) == m_tail.load(std::memory_order_acquire);
+    }
+
+    size_t capacity() const { return m_mask + 1; }
+
+private:
+    static const size_t kCacheLine = 64;
+
+    //*消费者一侧
+    char m_pad0[kCacheLine];
+    std::atomic<size_t> m_head = {0};
+    size_t m_cachedTail = 0;
+    char m_pad1[kCacheLine - sizeof(std::atomic<size_t>) - sizeof(size_t)];
+    //*生产者一侧
+    std::atomic<size_t> m_tail = {0};
+    size_t m_cachedHead = 0;
+    char m_pad2[kCacheLine - sizeof(std::atomic<size_t>) - sizeof(size_t)];
+    //*只读
+    size_t m_mask = 0;
+    T *m_slots = nullptr;
+};
+
+}//myconcurrent
@@ -0,0 +1,273 @@
+#include "stack_allocator.h"
+#include <assert.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <atomic>
+#include <vector>
+#include "MutexLock.h"
+#include "Logging.h"
+
+namespace myconcurrent{
+
+namespace{
+
+//*档位：2^12(4KB)到2^23(8MB)
+const int kMinShift = 12;
+const int kMaxShift = 23;
+const int kClasses = kMaxShift - kMinShift + 1;
+
+/**
+ * *空闲的栈本身存放链表节点，不额外分配
+ * *节点放在栈顶(高地址)，协程一开始就会用到这一页，不会为了挂链表多提交栈底的页
+ */
+struct FreeNode{
+    FreeNode *next;
+    void *stack;
+};
+
+struct FreeList{
+    FreeNode *head = nullptr;
+    size_t count = 0;
+
+    void push(void *p, size_t size){
+        FreeNode *node = reinterpret_cast<FreeNode *>(static_cast<char *>(p) + size) - 1;
+        node->next = head;
+        node->stack = p;
+        head = node;
+        ++count;
+    }
+
+    void *pop(){
+        FreeNode *node = head;
+        if(!node)
+            return nullptr;
+        head = node->next;
+        --count;
+        return node->stack;
+    }
+};
+
+std::atomic<size_t> s_high{16};
+std::atomic<size_t> s_low{8};
+std::atomic<size_t> s_global_limit{256 * 1024 * 1024};
+std::atomic<uint64_t> s_system_allocs{0};
+std::atomic<uint64_t> s_system_frees{0};
+
+//*size所在的档位，超过最大档位返回-1
+int ClassOf(size_t size){
+    int shift = kMinShift;
+    while(shift <= kMaxShift && ((size_t)1 << shift) < size)
+        ++shift;
+    return shift > kMaxShift ? -1 : shift - kMinShift;
+}
+
+size_t ClassSize(int c){
+    return (size_t)1 << (c + kMinShift);
+}
+
+size_t PageSize(){
+    static const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    return page;
+}
+
+size_t RoundToPage(size_t size){
+    size_t page = PageSize();
+    return (size + page - 1) & ~(page - 1);
+}
+
+/**
+ * *向系统申请栈：mmap保留size加一页的地址空间，最低的一页设为PROT_NONE作为保护页
+ * *栈向低地址增长，溢出时访问保护页直接段错误，不会悄悄写坏相邻的内存；页在第一次访问时才由内核分配
+ */
+void *SystemAlloc(size_t size){
+    size_t guard = PageSize();
+    size = RoundToPage(size);
+    void *base = mmap(nullptr, size + guard, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+    if(base == MAP_FAILED){
+        LOG_ERROR<<"StackAllocator mmap "<<size<<" bytes failed: "<<strerror(errno);
+        assert(false);
+        return nullptr;
+    }
+    if(mprotect(base, guard, PROT_NONE)){
+        LOG_ERROR<<"StackAllocator mprotect guard page failed: "<<strerror(errno);
+        assert(false);
+    }
+    ++s_system_allocs;
+    return static_cast<char *>(base) + guard;
+}
+
+void SystemFree(void *p, size_t size){
+    size_t guard = PageSize();
+    if(munmap(static_cast<char *>(p) - guard, RoundToPage(size) + guard)){
+        LOG_ERROR<<"StackAllocator munmap failed: "<<strerror(errno);
+    }
+    ++s_system_frees;
+}
+
+//*进全局池的栈交还已经提交的物理页，只保留栈顶放链表节点的一页，地址空间不变
+void Decommit(void *p, size_t size){
+    size_t keep = PageSize();
+    if(size > keep)
+        madvise(p, size - keep, MADV_DONTNEED);
+}
+
+struct GlobalPool{
+    MutexLock mutex;
+    FreeList lists[kClasses];
+    size_t bytes = 0;
+
+    //*从c档取至多n个放进out
+    void take(int c, FreeList &out, size_t n){
+        MutexLockGuard lock(mutex);
+        for(; n > 0; --n){
+            void *p = lists[c].pop();
+            if(!p)
+                break;
+            bytes -= ClassSize(c);
+            out.push(p, ClassSize(c));
+        }
+    }
+
+    //*把in中的n个放回c档，超出上限的还给系统
+    void give(int c, FreeList &in, size_t n){
+        size_t size = ClassSize(c);
+        size_t limit = s_global_limit.load(std::memory_order_relaxed);
+        //*先在锁外交还物理页，在全局池里等待的栈只占地址空间
+        FreeList batch;
+        for(; n > 0; --n){
+            void *p = in.pop();
+            if(!p)
+                break;
+            Decommit(p, size);
+            batch.push(p, size);
+        }
+        FreeList overflow;
+        {
+            MutexLockGuard lock(mutex);
+            while(void *p = batch.pop()){
+                if(bytes + size <= limit){
+                    lists[c].push(p, size);
+                    bytes += size;
+                }else{
+                    overflow.push(p, size);
+                }
+            }
+        }
+        while(void *p = overflow.pop())
+            SystemFree(p, size);
+    }
+};
+
+//*不析构，线程退出时还要往里面归还
+GlobalPool &Global(){
+    static GlobalPool *pool = new GlobalPool;
+    return *pool;
+}
+
+struct ThreadCache{
+    FreeList lists[kClasses];
+
+    ~ThreadCache();
+};
+
+//*线程缓存已经析构，之后其他线程局部变量的析构中释放的栈直接走全局池
+static thread_local bool t_cache_dead = false;
+
+ThreadCache::~ThreadCache(){
+    for(int c = 0; c < kClasses; ++c)
+        Global().give(c, lists[c], lists[c].count);
+    t_cache_dead = true;
+}
+
+ThreadCache *LocalCache(){
+    if(t_cache_dead)
+        return nullptr;
+    static thread_local ThreadCache cache;
+    return &cache;
+}
+
+}//namespace
+
+void *StackAllocator::Alloc(size_t size){
+    int c = ClassOf(size);
+    if(c < 0)
+        return SystemAlloc(size);
+    ThreadCache *cache = LocalCache();
+    if(cache){
+        FreeList &list = cache->lists[c];
+        if(!list.count){
+            //*一次取回到低水位，避免每次都去抢全局池的锁
+            size_t low = s_low.load(std::memory_order_relaxed);
+            Global().take(c, list, low ? low : 1);
+        }
+        if(void *p = list.pop())
+            return p;
+    }else{
+        FreeList one;
+        Global().take(c, one, 1);
+        if(void *p = one.pop())
+            return p;
+    }
+    return SystemAlloc(ClassSize(c));
+}
+
+void StackAllocator::Dealloc(void *vp, size_t size){
+    if(!vp)
+        return;
+    int c = ClassOf(size);
+    if(c < 0){
+        SystemFree(vp, size);
+        return;
+    }
+    ThreadCache *cache = LocalCache();
+    size_t high = s_high.load(std::memory_order_relaxed);
+    if(!cache || high == 0){
+        FreeList one;
+        one.push(vp, ClassSize(c));
+        Global().give(c, one, 1);
+        return;
+    }
+    FreeList &list = cache->lists[c];
+    list.push(vp, ClassSize(c));
+    if(list.count > high){
+        size_t low = s_low.load(std::memory_order_relaxed);
+        Global().give(c, list, list.count - low);
+    }
+}
+
+void StackAllocator::SetWatermarks(size_t high, size_t low){
+    if(low > high){
+        LOG_ERROR<<"StackAllocator watermarks low="<<low<<" > high="<<high;
+        assert(false);
+        low = high;
+    }
+    s_high = high;
+    s_low = low;
+}
+
+void StackAllocator::SetGlobalLimit(size_t bytes){
+    s_global_limit = bytes;
+}
+
+void StackAllocator::FlushThreadCache(){
+    ThreadCache *cache = LocalCache();
+    if(!cache)
+        return;
+    for(int c = 0; c < kClasses; ++c)
+        Global().give(c, cache->lists[c], cache->lists[c].count);
+}
+
+StackAllocator::Stats StackAllocator::GetStats(){
+    Stats stats;
+    stats.systemAllocs = s_system_allocs;
+    stats.systemFrees = s_system_frees;
+    GlobalPool &pool = Global();
+    MutexLockGuard lock(pool.mutex);
+    stats.globalBytes = pool.bytes;
+    return stats;
+}
+
+}//myconcurrent
@@ -0,0 +1,43 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+namespace myconcurrent{
+
+/**
+ * *协程栈分配器
+ * *栈按2的幂分档(4KB~8MB)，每个线程每档一个空闲链表，协程析构时栈放回当前线程的链表，下次创建直接复用
+ * *线程的链表超过高水位时降到低水位，多出来的还给全局池；线程的链表空了先从全局池批量取回
+ * *全局池超过字节上限的部分才真正还给系统；超过最大档位的栈不缓存
+ * *栈由mmap保留地址空间，最低一页是PROT_NONE保护页，溢出时直接段错误；物理页在第一次访问时才分配，
+ * *放进全局池时交还已经用过的物理页，所以可以给协程很大的栈，只为实际用到的部分付出内存
+ */
+class StackAllocator{
+public:
+    //*分配至少size字节的栈
+    static void *Alloc(size_t size);
+
+    //*释放Alloc得到的栈，size和分配时相同
+    static void Dealloc(void *vp, size_t size);
+
+    //*每个线程每档缓存的栈数的高低水位，high为0表示不在线程中缓存，low不能大于high
+    static void SetWatermarks(size_t high, size_t low);
+
+    //*全局池最多缓存的字节数，0表示不缓存
+    static void SetGlobalLimit(size_t bytes);
+
+    //*把当前线程缓存的栈还给全局池，线程退出时自动调用
+    static void FlushThreadCache();
+
+    struct Stats{
+        //*向系统申请和归还的次数
+        uint64_t systemAllocs = 0;
+        uint64_t systemFrees = 0;
+        //*全局池中缓存的字节数
+        size_t globalBytes = 0;
+    };
+
+    static Stats GetStats();
+};
+
+}//myconcurrent
@@ -0,0 +1,176 @@
+#include "stack_profile.h"
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <unordered_map>
+#include "MutexLock.h"
+
+namespace myconcurrent{
+
+namespace{
+
+const uint64_t kPattern = 0x5AA5C33CF00FA55AULL;
+//*没有允许缩小的标签放大时的余量
+const size_t kGrowHeadroom = 2;
+const size_t kMinSuggested = 16 * 1024;
+const size_t kMaxSuggested = 8 * 1024 * 1024;
+const char kUntagged[] = "(untagged)";
+
+std::atomic<size_t> s_sample_every{0};
+std::atomic<bool> s_adaptive{false};
+
+struct Entry{
+    uint64_t samples = 0;
+    size_t maxUsed = 0;
+    uint64_t totalUsed = 0;
+    //*出过样本的不同协程，够kMinSamples个就不再记
+    std::vector<uint64_t> fibers;
+    bool shrink = false;
+    StackProfile::ShrinkPolicy policy;
+    //*创建协程时不加锁读取：按样本算出的栈大小，允许缩小时的栈大小(不能缩小时为0)
+    std::atomic<size_t> suggested{0};
+    std::atomic<size_t> shrinkTo{0};
+};
+
+struct Registry{
+    MutexLock mutex;
+    //*条目创建后不删除，线程可以缓存指针
+    std::map<std::string, Entry *> entries;
+
+    Entry *get(const char *tag){
+        MutexLockGuard lock(mutex);
+        Entry *&e = entries[tag];
+        if(!e)
+            e = new Entry;
+        return e;
+    }
+};
+
+//*不析构，线程退出时协程还可能在记录
+Registry &Global(){
+    static Registry *registry = new Registry;
+    return *registry;
+}
+
+size_t Suggest(size_t maxUsed, size_t headroom, size_t floor){
+    size_t size = kMinSuggested;
+    while((size < maxUsed * headroom || size < floor) && size < kMaxSuggested)
+        size <<= 1;
+    return size;
+}
+
+//*持有registry.mutex时根据样本更新建议值
+void Update(Entry *e){
+    if(e->samples == 0)
+        return;
+    e->suggested.store(Suggest(e->maxUsed, kGrowHeadroom, 0), std::memory_order_relaxed);
+    size_t shrink_to = 0;
+    if(e->shrink && e->fibers.size() >= StackProfile::kMinSamples)
+        shrink_to = Suggest(e->maxUsed, e->policy.headroom, e->policy.floor);
+    e->shrinkTo.store(shrink_to, std::memory_order_relaxed);
+}
+
+static thread_local size_t t_sample_count = 0;
+
+}//namespace
+
+void StackProfile::SetSampling(size_t every){
+    s_sample_every = every;
+}
+
+void StackProfile::SetAdaptive(bool enable){
+    s_adaptive = enable;
+}
+
+void StackProfile::AllowShrink(const char *tag, const ShrinkPolicy &policy){
+    Registry &registry = Global();
+    MutexLockGuard lock(registry.mutex);
+    Entry *&e = registry.entries[tag];
+    if(!e)
+        e = new Entry;
+    e->shrink = true;
+    e->policy = policy;
+    if(e->policy.headroom == 0)
+        e->policy.headroom = 1;
+    Update(e);
+}
+
+bool StackProfile::ShouldSample(){
+    size_t every = s_sample_every.load(std::memory_order_relaxed);
+    if(every == 0)
+        return false;
+    if(++t_sample_count < every)
+        return false;
+    t_sample_count = 0;
+    return true;
+}
+
+void StackProfile::Paint(void *stack, size_t size){
+    uint64_t *p = static_cast<uint64_t *>(stack);
+    for(size_t i = 0, n = size / sizeof(uint64_t); i < n; ++i)
+        p[i] = kPattern;
+}
+
+size_t StackProfile::Measure(const void *stack, size_t size){
+    //*栈向低地址增长，从栈底往上第一个不是图案的字就是最深到过的位置
+    const uint64_t *p = static_cast<const uint64_t *>(stack);
+    size_t n = size / sizeof(uint64_t);
+    size_t i = 0;
+    while(i < n && p[i] == kPattern)
+        ++i;
+    return (n - i) * sizeof(uint64_t);
+}
+
+void StackProfile::Record(const char *tag, size_t used, uint64_t fiber_id){
+    Registry &registry = Global();
+    MutexLockGuard lock(registry.mutex);
+    Entry *&e = registry.entries[tag ? tag : kUntagged];
+    if(!e)
+        e = new Entry;
+    ++e->samples;
+    e->totalUsed += used;
+    if(used > e->maxUsed)
+        e->maxUsed = used;
+    if(e->fibers.size() < kMinSamples
+       && std::find(e->fibers.begin(), e->fibers.end(), fiber_id) == e->fibers.end())
+        e->fibers.push_back(fiber_id);
+    if(tag)
+        Update(e);
+}
+
+size_t StackProfile::SuggestSize(const char *tag, size_t default_size){
+    if(!tag || !s_adaptive.load(std::memory_order_relaxed))
+        return 0;
+    //*标签一般是字符串常量，按地址缓存条目，之后创建协程不用加锁
+    static thread_local std::unordered_map<const char *, Entry *> cache;
+    Entry *&e = cache[tag];
+    if(!e)
+        e = Global().get(tag);
+    if(size_t shrink_to = e->shrinkTo.load(std::memory_order_relaxed))
+        return shrink_to;
+    size_t suggested = e->suggested.load(std::memory_order_relaxed);
+    return suggested > default_size ? suggested : 0;
+}
+
+std::vector<StackProfile::TagStats> StackProfile::GetStats(){
+    std::vector<TagStats> result;
+    Registry &registry = Global();
+    MutexLockGuard lock(registry.mutex);
+    for(auto &kv : registry.entries){
+        Entry *e = kv.second;
+        if(e->samples == 0)
+            continue;
+        TagStats stats;
+        stats.tag = kv.first;
+        stats.samples = e->samples;
+        stats.maxUsed = e->maxUsed;
+        stats.avgUsed = e->totalUsed / e->samples;
+        size_t shrink_to = e->shrinkTo.load(std::memory_order_relaxed);
+        stats.suggested = shrink_to ? shrink_to : e->suggested.load(std::memory_order_relaxed);
+        stats.shrink = e->shrink;
+        result.push_back(stats);
+    }
+    return result;
+}
+
+}//myconcurrent
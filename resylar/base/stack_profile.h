@@ -0,0 +1,76 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace myconcurrent{
+
+/**
+ * *协程栈用量统计
+ * *开启抽样后，被抽中的协程创建时把整个栈涂成固定图案，执行完时从栈底往上找第一个被改写的位置，得到栈的最高水位
+ * *结果按协程的入口标签(Scheduler::schedule的tag)汇总；开启自适应后，同一标签的新协程按统计结果选择栈大小
+ * *涂栈会提交整个栈的物理页，只适合抽样；共享栈协程不参与统计
+ */
+class StackProfile{
+public:
+    //*每every个协程抽查一个，0表示关闭(默认)
+    static void SetSampling(size_t every);
+
+    /**
+     * *开启后按统计结果调整同一标签新协程的栈大小：默认只放大，最高水位的两倍超过默认栈大小时才换成更大的栈
+     * *抽中的协程同样按这个大小运行，用量接近栈大小时最高水位随之上涨，建议值也跟着变大
+     */
+    static void SetAdaptive(bool enable);
+
+    //*允许缩小时的参数
+    struct ShrinkPolicy{
+        //*栈大小取最高水位的headroom倍，向上取到2的幂
+        size_t headroom = 4;
+        //*缩小的下限
+        size_t floor = 64 * 1024;
+    };
+
+    /**
+     * *允许tag的协程栈缩小到默认大小以下
+     * *抽样只看到跑过的路径，没跑到的深调用栈会溢出到保护页，所以只对确认调用深度稳定的标签开启；
+     * *至少要有kMinSamples个不同协程的样本才会缩小，调度器协程池里reset()复用的协程算同一个
+     */
+    static void AllowShrink(const char *tag, const ShrinkPolicy &policy);
+
+    //*当前线程上新建的协程是否要被抽查
+    static bool ShouldSample();
+
+    //*把栈涂成图案
+    static void Paint(void *stack, size_t size);
+
+    //*涂过的栈实际用到的字节数
+    static size_t Measure(const void *stack, size_t size);
+
+    //*记录协程fiber_id的一次测量结果，tag为空时记到"(untagged)"下，不参与自适应
+    static void Record(const char *tag, size_t used, uint64_t fiber_id);
+
+    /**
+     * *tag建议的栈大小，返回0表示用default_size
+     * *没有开启自适应、没有标签时返回0；没有允许缩小的标签不会小于default_size
+     */
+    static size_t SuggestSize(const char *tag, size_t default_size);
+
+    //*缩小前至少需要的不同协程样本数
+    static const size_t kMinSamples = 8;
+
+    struct TagStats{
+        std::string tag;
+        uint64_t samples = 0;
+        size_t maxUsed = 0;
+        size_t avgUsed = 0;
+        //*按样本算出的栈大小，没有样本时为0；没有允许缩小的标签实际不低于默认栈大小
+        size_t suggested = 0;
+        //*是否允许缩小
+        bool shrink = false;
+    };
+
+    static std::vector<TagStats> GetStats();
+};
+
+}//myconcurrent
@@ -0,0 +1,166 @@
+#include "../scheduler.h"
+#include "../channel.h"
+#include <atomic>
+#include <cstdio>
+#include <thread>
+#include <unistd.h>
+using namespace myconcurrent;
+
+static int g_failed = 0;
+
+#define CHECK(cond) do{ if(!(cond)){ printf("%s:%d check failed: %s\n", __FILE__, __LINE__, #cond); ++g_failed; } }while(0)
+
+//*最多等timeout_ms毫秒
+static bool waitFor(const std::atomic<int> &value, int target, int timeout_ms){
+    for(int i = 0; i < timeout_ms * 10 && value.load() < target; ++i)
+        usleep(100);
+    return value.load() >= target;
+}
+
+/**
+ * *R1 select(recv B, recv A)，R2 recv A，都挂在A上，R1在前
+ * *A上的send唤醒R1；B上的send发现R1已经被唤醒，谁也不唤醒；R1醒来完成了B上的分支
+ * *A上的数据留在缓冲区里，R2必须还能被唤醒
+ */
+static void testSelectPassesWakeup(){
+    //*只有一个工作线程，协程按提交顺序执行，交错是确定的
+    Scheduler sc(1, false, "select");
+    sc.start();
+    Channel<int> a(4), b(4);
+    std::atomic<int> r1(-1), r2(-1), done(0);
+    sc.schedule([&](){
+        int x = 0, y = 0;
+        Select sel;
+        sel.recv(b, x).recv(a, y);
+        r1 = sel.wait() == 0 ? x : 100 + y;
+        ++done;
+    });
+    sc.schedule([&](){
+        int v = 0;
+        if(a.recv(v))
+            r2 = v;
+        ++done;
+    });
+    //*等两个接收者都挂起
+    usleep(50 * 1000);
+    sc.schedule([&](){
+        a.send(1);
+        b.send(2);
+    });
+    bool finished = waitFor(done, 2, 2000);
+    CHECK(finished);
+    CHECK(r1.load() == 2);
+    CHECK(r2.load() == 1);
+    if(!finished){
+        //*让卡住的接收者退出，调度器才能停下
+        a.close();
+        b.close();
+    }
+    sc.stop();
+}
+
+//*发送一侧：S1 select(send B, send A)，S2 send A，都等A上的空位
+static void testSelectPassesSendWakeup(){
+    Scheduler sc(1, false, "select_send");
+    sc.start();
+    Channel<int> a(1), b(1);
+    a.send(0);
+    b.send(0);
+    std::atomic<int> done(0);
+    sc.schedule([&](){
+        int x = 10, y = 20;
+        Select sel;
+        sel.send(b, x).send(a, y);
+        sel.wait();
+        ++done;
+    });
+    sc.schedule([&](){
+        a.send(30);
+        ++done;
+    });
+    usleep(50 * 1000);
+    sc.schedule([&](){
+        int v = 0;
+        a.recv(v);
+        b.recv(v);
+    });
+    bool finished = waitFor(done, 2, 2000);
+    CHECK(finished);
+    if(!finished){
+        a.close();
+        b.close();
+    }
+    sc.stop();
+}
+
+//*多个工作线程上的生产者、select消费者，每个值恰好收到一次
+static void testSelectStress(){
+    Scheduler sc(4, false, "select_stress");
+    sc.start();
+    const int producers = 4, consumers = 4, count = 5000;
+    Channel<int> a(8), b(8);
+    std::atomic<long long> sum(0);
+    std::atomic<int> received(0), finished(0);
+    for(int p = 0; p < producers; ++p){
+        sc.schedule([&, p](){
+            for(int i = 1; i <= count; ++i)
+                (i % 2 ? a : b).send(i);
+            ++finished;
+        });
+    }
+    for(int c = 0; c < consumers; ++c){
+        sc.schedule([&, c](){
+            while(true){
+                int x = 0, y = 0;
+                bool okA = false, okB = false;
+                int v;
+                if(c % 2){
+                    Select sel;
+                    sel.recv(a, x, &okA).recv(b, y, &okB);
+                    int idx = sel.wait();
+                    if(!(idx == 0 ? okA : okB))
+                        break;
+                    v = idx == 0 ? x : y;
+                }else{
+                    //*一半的消费者只收A，和select的消费者抢同一个通道
+                    if(!a.recv(x))
+                        break;
+                    v = x;
+                }
+                sum += v;
+                ++received;
+            }
+            ++finished;
+        });
+    }
+    bool ok = waitFor(received, producers * count, 10000);
+    CHECK(ok);
+    a.close();
+    b.close();
+    waitFor(finished, producers + consumers, 2000);
+    CHECK(sum.load() == (long long)producers * count * (count + 1) / 2);
+    sc.stop();
+}
+
+//*关闭后send失败，recv取完剩余数据后失败
+static void testClose(){
+    Channel<int> ch(4);
+    CHECK(ch.send(1) && ch.send(2));
+    ch.close();
+    CHECK(!ch.send(3));
+    int v = 0;
+    CHECK(ch.recv(v) && v == 1);
+    CHECK(ch.recv(v) && v == 2);
+    CHECK(!ch.recv(v));
+}
+
+int main(){
+    testClose();
+    testSelectPassesWakeup();
+    testSelectPassesSendWakeup();
+    testSelectStress();
+    if(g_failed)
+        return 1;
+    printf("channel ok\n");
+    return 0;
+}
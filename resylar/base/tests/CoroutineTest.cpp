@@ -0,0 +1,124 @@
+#include "../coroutine.h"
+#include <cstdio>
+
+/**
+ * *C++20无栈协程前端的测试，需要-std=c++20编译；低版本编译时coroutine.h为空，这里直接跳过
+ */
+#if defined(__cpp_impl_coroutine)
+
+#include <chrono>
+#include <stdexcept>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+using namespace myconcurrent;
+
+static int g_failed = 0;
+
+#define CHECK(cond) do{ if(!(cond)){ printf("%s:%d check failed: %s\n", __FILE__, __LINE__, #cond); ++g_failed; } }while(0)
+
+static uint64_t nowMs(){
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+               std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void setNonBlock(int fd){
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+
+static Task<int> add(int a, int b){
+    co_return a + b;
+}
+
+//*嵌套的Task<T>
+static Task<int> sum(int n){
+    int total = 0;
+    for(int i = 1; i <= n; ++i)
+        total += co_await add(i, 0);
+    co_return total;
+}
+
+static Task<int> fail(){
+    throw std::runtime_error("inner");
+    co_return 0;
+}
+
+//*内层抛出的异常在co_await处重新抛出
+static Task<int> catchInner(){
+    try{
+        co_await fail();
+    }catch(std::runtime_error &e){
+        co_return 1;
+    }
+    co_return 0;
+}
+
+//*定时器恢复
+static Task<uint64_t> sleepFor(uint64_t ms){
+    uint64_t start = nowMs();
+    co_await co::sleep(ms);
+    co_return nowMs() - start;
+}
+
+//*IO恢复：对端稍后才写，读一侧挂起等事件
+static Task<ssize_t> readLater(int fd){
+    char buf[16];
+    ssize_t n = co_await co::read(fd, buf, sizeof(buf));
+    co_return n;
+}
+
+static Task<void> writeLater(int fd){
+    co_await co::sleep(30);
+    co_await co::write(fd, "hello", 5);
+}
+
+static Task<int> readTimeout(int fd){
+    char c;
+    ssize_t n = co_await co::read(fd, &c, 1, 30);
+    co_return n < 0 ? errno : 0;
+}
+
+int main(){
+    IOManager iom(2, false, "coroutine");
+
+    CHECK(co::spawn(sum(100), &iom).get() == 5050);
+    CHECK(co::spawn(catchInner(), &iom).get() == 1);
+    //*没有捕获的异常传到Future
+    Future<int> failed = co::spawn(fail(), &iom);
+    bool thrown = false;
+    try{
+        failed.get();
+    }catch(std::runtime_error &e){
+        thrown = true;
+    }
+    CHECK(thrown);
+
+    CHECK(co::spawn(sleepFor(50), &iom).get() >= 50);
+
+    int fds[2];
+    CHECK(pipe(fds) == 0);
+    setNonBlock(fds[0]);
+    setNonBlock(fds[1]);
+    Future<ssize_t> reader = co::spawn(readLater(fds[0]), &iom);
+    Future<void> writer = co::spawn(writeLater(fds[1]), &iom);
+    CHECK(reader.get() == 5);
+    writer.get();
+    CHECK(co::spawn(readTimeout(fds[0]), &iom).get() == ETIMEDOUT);
+    close(fds[0]);
+    close(fds[1]);
+
+    iom.stop();
+    if(g_failed)
+        return 1;
+    printf("coroutine ok\n");
+    return 0;
+}
+
+#else
+
+int main(){
+    printf("coroutine test needs -std=c++20, skipped\n");
+    return 0;
+}
+
+#endif
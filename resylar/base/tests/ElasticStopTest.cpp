@@ -0,0 +1,53 @@
+#include "../iomanager.h"
+#include <atomic>
+#include <cstdio>
+#include <unistd.h>
+using namespace myconcurrent;
+
+//*弹性调度器没有涨到上限时，没有用到的线程槽位是空的，停止时不能去join
+static std::atomic<int> g_done(0);
+
+static void runSome(Scheduler &sc, int n){
+    int target = g_done.load() + n;
+    for(int i = 0; i < n; ++i)
+        sc.schedule([](){ ++g_done; });
+    while(g_done.load() < target)
+        usleep(100);
+}
+
+int main(){
+    {
+        Scheduler sc(2, false, "elastic", {}, 8);
+        sc.start();
+        runSome(sc, 100);
+        sc.stop();
+    }
+    {
+        Scheduler sc(2, true, "elastic_caller", {}, 8);
+        sc.start();
+        for(int i = 0; i < 100; ++i)
+            sc.schedule([](){ ++g_done; });
+        sc.stop();
+    }
+    {
+        Scheduler sc(2, false, "elastic_deadline", {}, 8);
+        sc.start();
+        runSome(sc, 100);
+        Scheduler::StopReport report = sc.stop(100);
+        if(!report.drained){
+            printf("elastic stop(timeout) did not drain\n");
+            return 1;
+        }
+    }
+    {
+        //*析构时停止
+        IOManager iom(2, false, "elastic_io", {}, 8);
+        runSome(iom, 100);
+    }
+    if(g_done.load() != 400){
+        printf("done=%d, expected 400\n", g_done.load());
+        return 1;
+    }
+    printf("elastic stop ok\n");
+    return 0;
+}
@@ -0,0 +1,79 @@
+#include "../scheduler.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <unistd.h>
+using namespace myconcurrent;
+
+/**
+ * *扇出基准：每个任务在工作线程里再提交kFanout个子任务，形成一棵kDepth层的任务树
+ * *子任务都进入提交者的本地队列，其他线程只能靠偷取分到任务，用来观察工作窃取随线程数的扩展
+ * *用法：fanout_bench [最大工作线程数]
+ */
+static const int kFanout = 4;
+static const int kDepth = 9;
+//*每个任务的计算量，避免只测到调度开销
+static const int kWork = 2000;
+
+static std::atomic<uint64_t> g_done(0);
+static std::atomic<uint64_t> g_sink(0);
+
+static void node(int depth){
+    uint64_t x = depth;
+    for(int i = 0; i < kWork; ++i)
+        x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+    g_sink.fetch_add(x & 1, std::memory_order_relaxed);
+    if(depth > 0){
+        Scheduler *sc = Scheduler::GetThis();
+        for(int i = 0; i < kFanout; ++i)
+            sc->schedule([depth](){ node(depth - 1); });
+    }
+    g_done.fetch_add(1, std::memory_order_relaxed);
+}
+
+static uint64_t treeSize(){
+    uint64_t total = 0, level = 1;
+    for(int d = 0; d <= kDepth; ++d){
+        total += level;
+        level *= kFanout;
+    }
+    return total;
+}
+
+//*返回整棵树执行完的纳秒数
+static uint64_t runTree(Scheduler &sc){
+    uint64_t target = g_done.load() + treeSize();
+    auto start = std::chrono::steady_clock::now();
+    sc.schedule([](){ node(kDepth); });
+    while(g_done.load() < target)
+        usleep(50);
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char *argv[]){
+    int maxThreads = argc > 1 ? atoi(argv[1]) : (int)std::max(1u, std::thread::hardware_concurrency());
+    const int rounds = 5;
+    double base = 0;
+    for(int threads = 1;; threads = std::min(threads * 2, maxThreads)){
+        Scheduler sc(threads, false, "fanout");
+        sc.start();
+        //*预热
+        runTree(sc);
+        uint64_t best = ~0ULL;
+        for(int i = 0; i < rounds; ++i)
+            best = std::min(best, runTree(sc));
+        sc.stop();
+        double ns = (double)best / treeSize();
+        if(threads == 1)
+            base = ns;
+        printf("threads=%d tasks=%llu ns_per_task=%.1f speedup=%.2f\n",
+               threads, (unsigned long long)treeSize(), ns, base / ns);
+        fflush(stdout);
+        if(threads >= maxThreads)
+            break;
+    }
+    return 0;
+}
@@ -0,0 +1,152 @@
+#include "../scheduler.h"
+#include "../fiber.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+using namespace myconcurrent;
+
+/**
+ * *协程和调度器的基准测试，每项结果输出一行JSON，方便和基线对比：
+ * *{"bench":名字,"workers":工作线程数(不经过调度器时为0),"unit":"ns","samples":样本数,
+ * * "mean":平均值,"p50":..,"p90":..,"p99":..,"p999":..,"max":..}
+ * *用法：fiber_bench [最大工作线程数] [样本数倍率]
+ */
+
+static uint64_t nowNs(){
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void report(const char *bench, int workers, std::vector<double> &samples){
+    std::sort(samples.begin(), samples.end());
+    size_t n = samples.size();
+    double sum = 0;
+    for(size_t i = 0; i < n; ++i)
+        sum += samples[i];
+    //*最近秩法取百分位
+    auto pct = [&](double p){ return samples[std::min(n - 1, (size_t)(p * n))]; };
+    printf("{\"bench\":\"%s\",\"workers\":%d,\"unit\":\"ns\",\"samples\":%zu,"
+           "\"mean\":%.1f,\"p50\":%.1f,\"p90\":%.1f,\"p99\":%.1f,\"p999\":%.1f,\"max\":%.1f}\n",
+           bench, workers, n, sum / n, pct(0.50), pct(0.90), pct(0.99), pct(0.999), samples[n - 1]);
+    fflush(stdout);
+}
+
+//*单次切换只有几十纳秒，和读时钟的开销相当，每个样本是kBatch次的平均值
+static const int kBatch = 64;
+
+//*resume到协程再yield回来的一次往返
+static void benchResumeYield(int scale){
+    bool stop = false;
+    Fiber::GetThis();
+    Fiber::ptr fiber(new Fiber([&stop](){
+        while(!stop)
+            Fiber::GetThis()->yield();
+    }, 0, false));
+    for(int i = 0; i < 1000; ++i)
+        fiber->resume();
+    std::vector<double> samples;
+    for(int s = 0; s < 10000 * scale; ++s){
+        uint64_t start = nowNs();
+        for(int i = 0; i < kBatch; ++i)
+            fiber->resume();
+        samples.push_back((double)(nowNs() - start) / kBatch);
+    }
+    stop = true;
+    fiber->resume();
+    report("resume_yield", 0, samples);
+}
+
+//*创建协程、执行到结束、析构，栈来自StackAllocator的缓存
+static void benchCreateDestroy(int scale){
+    Fiber::GetThis();
+    std::vector<double> samples;
+    for(int s = 0; s < 2000 * scale; ++s){
+        uint64_t start = nowNs();
+        for(int i = 0; i < kBatch; ++i){
+            Fiber::ptr fiber(new Fiber([](){}, 0, false));
+            fiber->resume();
+        }
+        samples.push_back((double)(nowNs() - start) / kBatch);
+    }
+    report("create_destroy", 0, samples);
+}
+
+//*执行完的协程reset()换一个回调再执行，不重新分配栈
+static void benchReset(int scale){
+    Fiber::GetThis();
+    Fiber::ptr fiber(new Fiber([](){}, 0, false));
+    fiber->resume();
+    std::vector<double> samples;
+    for(int s = 0; s < 2000 * scale; ++s){
+        uint64_t start = nowNs();
+        for(int i = 0; i < kBatch; ++i){
+            fiber->reset([](){});
+            fiber->resume();
+        }
+        samples.push_back((double)(nowNs() - start) / kBatch);
+    }
+    report("reset_reuse", 0, samples);
+}
+
+/**
+ * *从外部线程提交回调到它开始执行的时间
+ * *idle：一次只提交一个，等它执行完再提交下一个，包含唤醒空闲线程的开销
+ * *burst：一次提交kBurst个，每个任务各算一个样本，包含排队的时间
+ */
+static const int kBurst = 256;
+
+static void benchSchedule(int workers, int scale){
+    Scheduler sc(workers, false, "bench");
+    sc.start();
+    std::vector<double> idle(1000 * scale), burst(kBurst * 40 * scale);
+    std::atomic<int> done(0);
+
+    for(size_t i = 0; i < idle.size(); ++i){
+        double *out = &idle[i];
+        uint64_t start = nowNs();
+        sc.schedule([out, start, &done](){
+            *out = (double)(nowNs() - start);
+            done.fetch_add(1, std::memory_order_release);
+        });
+        while(done.load(std::memory_order_acquire) != (int)i + 1)
+            std::this_thread::yield();
+    }
+    report("schedule_idle", workers, idle);
+
+    done = 0;
+    for(size_t i = 0; i < burst.size(); i += kBurst){
+        uint64_t start = nowNs();
+        for(size_t j = i; j < i + kBurst; ++j){
+            double *out = &burst[j];
+            sc.schedule([out, start, &done](){
+                *out = (double)(nowNs() - start);
+                done.fetch_add(1, std::memory_order_release);
+            });
+        }
+        while(done.load(std::memory_order_acquire) != (int)(i + kBurst))
+            std::this_thread::yield();
+    }
+    report("schedule_burst", workers, burst);
+    sc.stop();
+}
+
+int main(int argc, char *argv[]){
+    int maxWorkers = argc > 1 ? atoi(argv[1]) : (int)std::min(8u, std::max(1u, std::thread::hardware_concurrency()));
+    int scale = argc > 2 ? std::max(1, atoi(argv[2])) : 1;
+
+    benchResumeYield(scale);
+    benchCreateDestroy(scale);
+    benchReset(scale);
+    //*1、2、4……直到maxWorkers
+    for(int workers = 1;; workers = std::min(workers * 2, maxWorkers)){
+        benchSchedule(workers, scale);
+        if(workers >= maxWorkers)
+            break;
+    }
+    return 0;
+}
@@ -0,0 +1,113 @@
+#include "../scheduler.h"
+#include "../fiber_local.h"
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <unistd.h>
+using namespace myconcurrent;
+
+static int g_failed = 0;
+
+#define CHECK(cond) do{ if(!(cond)){ printf("%s:%d check failed: %s\n", __FILE__, __LINE__, #cond); ++g_failed; } }while(0)
+
+//*统计全局堆分配次数，确认has()不会为了查询去扩容槽位
+static std::atomic<uint64_t> g_allocs(0);
+
+void *operator new(size_t n){
+    ++g_allocs;
+    if(void *p = malloc(n ? n : 1))
+        return p;
+    throw std::bad_alloc();
+}
+void operator delete(void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+
+static std::atomic<int> g_live(0);
+
+struct Context{
+    int id = -1;
+    Context() { ++g_live; }
+    ~Context() { --g_live; }
+};
+
+static FiberLocal<Context> t_ctx;
+static FiberLocal<int> t_count;
+
+//*同一个线程上交替执行、在线程之间迁移的协程各自看到自己的值
+static void testIsolation(){
+    const int fibers = 200, rounds = 5;
+    std::atomic<int> done(0), bad(0);
+    {
+        Scheduler sc(4, false, "fiber_local");
+        sc.start();
+        for(int i = 0; i < fibers; ++i){
+            sc.schedule([&done, &bad, i](){
+                if(t_ctx.has() || t_count.has())
+                    ++bad;
+                t_ctx->id = i;
+                *t_count = i * 2;
+                for(int k = 0; k < rounds; ++k){
+                    Scheduler::GetThis()->yieldSlice();
+                    if(t_ctx->id != i || *t_count != i * 2)
+                        ++bad;
+                }
+                ++done;
+            });
+        }
+        while(done.load() < fibers)
+            usleep(1000);
+        sc.stop();
+    }
+    CHECK(bad.load() == 0);
+    //*协程结束时析构
+    CHECK(g_live.load() == 0);
+}
+
+//*协程结束、reset()复用时析构，FiberLocal::reset()提前析构
+static void testDestroy(){
+    Fiber::GetThis();
+    Fiber::ptr fiber(new Fiber([](){
+        t_ctx->id = 1;
+        Fiber::GetThis()->yield();
+    }, 0, false));
+    fiber->resume();
+    CHECK(g_live.load() == 1);
+    fiber->resume();
+    CHECK(g_live.load() == 0);
+
+    fiber->reset([](){
+        t_ctx->id = 2;
+        t_ctx.reset();
+        CHECK(!t_ctx.has());
+        CHECK(g_live.load() == 0);
+        t_ctx->id = 3;
+    });
+    fiber->resume();
+    CHECK(g_live.load() == 0);
+}
+
+//*has()只查不建，槽位数组不会因为查询而扩容
+static void testHasDoesNotAllocate(){
+    static FiberLocal<int> t_late;
+    uint64_t allocs = 0;
+    bool has = true;
+    Fiber::ptr fiber(new Fiber([&allocs, &has](){
+        uint64_t before = g_allocs.load();
+        has = t_late.has();
+        allocs = g_allocs.load() - before;
+    }, 0, false));
+    fiber->resume();
+    CHECK(!has);
+    CHECK(allocs == 0);
+}
+
+int main(){
+    testIsolation();
+    testDestroy();
+    testHasDoesNotAllocate();
+    if(g_failed)
+        return 1;
+    printf("fiber local ok\n");
+    return 0;
+}
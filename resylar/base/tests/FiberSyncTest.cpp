@@ -0,0 +1,144 @@
+#include "../scheduler.h"
+#include "../fiber_sync.h"
+#include <atomic>
+#include <cstdio>
+#include <unistd.h>
+using namespace myconcurrent;
+
+static int g_failed = 0;
+
+#define CHECK(cond) do{ if(!(cond)){ printf("%s:%d check failed: %s\n", __FILE__, __LINE__, #cond); ++g_failed; } }while(0)
+
+static void waitFor(const std::atomic<int> &value, int target){
+    while(value.load() < target)
+        usleep(100);
+}
+
+//*多个工作线程上的协程争用同一把锁，临界区内同时只能有一个
+static void testMutex(Scheduler &sc){
+    const int fibers = 64, rounds = 2000;
+    FiberMutex mutex;
+    std::atomic<int> inside(0), overlaps(0), finished(0);
+    long counter = 0;
+    for(int i = 0; i < fibers; ++i){
+        sc.schedule([&](){
+            for(int k = 0; k < rounds; ++k){
+                FiberMutexGuard guard(mutex);
+                if(inside.fetch_add(1) != 0)
+                    ++overlaps;
+                ++counter;
+                inside.fetch_sub(1);
+            }
+            ++finished;
+        });
+    }
+    waitFor(finished, fibers);
+    CHECK(overlaps.load() == 0);
+    CHECK(counter == (long)fibers * rounds);
+}
+
+//*notify只唤醒一个等待者，notifyAll唤醒剩下的全部
+static void testCondition(Scheduler &sc){
+    const int fibers = 16;
+    FiberMutex mutex;
+    FiberCondition cond(mutex);
+    int waiting = 0, tokens = 0;
+    std::atomic<int> woken(0);
+    for(int i = 0; i < fibers; ++i){
+        sc.schedule([&](){
+            mutex.lock();
+            ++waiting;
+            while(tokens == 0)
+                cond.wait();
+            --tokens;
+            mutex.unlock();
+            ++woken;
+        });
+    }
+    //*全部进入等待后再通知
+    mutex.lock();
+    while(waiting != fibers){
+        mutex.unlock();
+        usleep(100);
+        mutex.lock();
+    }
+    tokens = 1;
+    cond.notify();
+    mutex.unlock();
+    waitFor(woken, 1);
+    usleep(20 * 1000);
+    CHECK(woken.load() == 1);
+
+    mutex.lock();
+    tokens = fibers - 1;
+    cond.notifyAll();
+    mutex.unlock();
+    waitFor(woken, fibers);
+    CHECK(woken.load() == fibers);
+}
+
+//*信号量的计数：tryWait不超过post的次数，等待者按post的次数放行
+static void testSemaphore(Scheduler &sc){
+    FiberSemaphore sem(3);
+    CHECK(sem.getCount() == 3);
+    CHECK(sem.tryWait() && sem.tryWait() && sem.tryWait());
+    CHECK(!sem.tryWait());
+    CHECK(sem.getCount() == 0);
+
+    const int fibers = 8;
+    std::atomic<int> passed(0);
+    for(int i = 0; i < fibers; ++i){
+        sc.schedule([&](){
+            sem.wait();
+            ++passed;
+        });
+    }
+    usleep(20 * 1000);
+    CHECK(passed.load() == 0);
+    for(int i = 0; i < fibers / 2; ++i)
+        sem.post();
+    waitFor(passed, fibers / 2);
+    usleep(20 * 1000);
+    CHECK(passed.load() == fibers / 2);
+    for(int i = 0; i < fibers / 2 + 1; ++i)
+        sem.post();
+    waitFor(passed, fibers);
+    CHECK(sem.getCount() == 1);
+}
+
+//*计数减到0之前等待者都不返回，减到0时全部放行
+static void testLatch(Scheduler &sc){
+    const int count = 4, fibers = 8;
+    FiberCountDownLatch latch(count);
+    std::atomic<int> released(0);
+    for(int i = 0; i < fibers; ++i){
+        sc.schedule([&](){
+            latch.wait();
+            ++released;
+        });
+    }
+    for(int i = 0; i < count - 1; ++i)
+        sc.schedule([&](){ latch.countDown(); });
+    usleep(20 * 1000);
+    CHECK(latch.getCount() == 1);
+    CHECK(released.load() == 0);
+    latch.countDown();
+    waitFor(released, fibers);
+    CHECK(latch.getCount() == 0);
+    //*已经减到0时直接返回
+    latch.wait();
+}
+
+int main(){
+    Scheduler sc(4, false, "fiber_sync");
+    sc.start();
+    testMutex(sc);
+    testCondition(sc);
+    testSemaphore(sc);
+    testLatch(sc);
+    sc.stop();
+    if(g_failed)
+        return 1;
+    printf("fiber sync ok\n");
+    return 0;
+}
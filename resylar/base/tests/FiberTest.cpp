@@ -0,0 +1,84 @@
+#include "../fiber.h"
+#include <cstdio>
+#include <cstring>
+using namespace myconcurrent;
+
+static int g_failed = 0;
+
+#define CHECK(cond) do{ if(!(cond)){ printf("%s:%d check failed: %s\n", __FILE__, __LINE__, #cond); ++g_failed; } }while(0)
+
+static const int kRounds = 100;
+static const size_t kBufSize = 8192;
+
+//*递归几层，让栈上有多个帧的局部变量
+static int nested(int depth, int id, int round){
+    volatile char frame[256];
+    memset((char *)frame, id + depth, sizeof(frame));
+    int below = 0;
+    if(depth > 0){
+        below = nested(depth - 1, id, round);
+    }else{
+        Fiber::GetThis()->yield();
+    }
+    for(size_t i = 0; i < sizeof(frame); ++i){
+        if(frame[i] != (char)(id + depth))
+            return -1;
+    }
+    return below < 0 ? -1 : below + 1;
+}
+
+/**
+ * *两个共享栈协程在同一块栈上交替执行，每次被挤占时栈被拷走、切回来时拷回
+ * *栈上的大数组、局部变量和递归帧在切换前后都要保持不变
+ */
+static void testSharedStackInterleave(){
+    Fiber::GetThis();
+    int bad[2] = {0, 0};
+    int finished[2] = {0, 0};
+    Fiber::ptr fibers[2];
+    for(int id = 0; id < 2; ++id){
+        int *pbad = &bad[id], *pdone = &finished[id];
+        fibers[id].reset(new Fiber([id, pbad, pdone](){
+            char buf[kBufSize];
+            memset(buf, 'a' + id, sizeof(buf));
+            long sum = 0;
+            for(int round = 0; round < kRounds; ++round){
+                long local = round * 1000 + id;
+                buf[round] = (char)('A' + id);
+                Fiber::GetThis()->yield();
+                if(local != round * 1000 + id)
+                    ++*pbad;
+                for(size_t i = 0; i < sizeof(buf); ++i){
+                    char expected = (int)i <= round ? (char)('A' + id) : (char)('a' + id);
+                    if(buf[i] != expected){
+                        ++*pbad;
+                        break;
+                    }
+                }
+                if(nested(4, id, round) != 5)
+                    ++*pbad;
+                sum += local;
+            }
+            if(sum != (long)kRounds * (kRounds - 1) / 2 * 1000 + (long)kRounds * id)
+                ++*pbad;
+            *pdone = 1;
+        }, 0, false, true, "interleave"));
+    }
+    //*A、B轮流执行，每次切换都要把对方的栈挤出去
+    while(!finished[0] || !finished[1]){
+        for(int id = 0; id < 2; ++id){
+            if(!finished[id])
+                fibers[id]->resume();
+        }
+    }
+    CHECK(bad[0] == 0);
+    CHECK(bad[1] == 0);
+}
+
+int main(){
+    testSharedStackInterleave();
+    if(g_failed)
+        return 1;
+    printf("fiber ok\n");
+    return 0;
+}
@@ -0,0 +1,151 @@
+#include "../future.h"
+#include <atomic>
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+using namespace myconcurrent;
+
+static int g_failed = 0;
+
+#define CHECK(cond) do{ if(!(cond)){ printf("%s:%d check failed: %s\n", __FILE__, __LINE__, #cond); ++g_failed; } }while(0)
+
+//*get()应当抛出msg
+template <class T>
+static bool throws(Future<T> &future, const std::string &msg){
+    try{
+        future.get();
+    }catch(std::runtime_error &e){
+        return e.what() == msg;
+    }
+    return false;
+}
+
+//*值和异常沿then链传递，出错的一步之后fn不再调用
+static void testThen(Scheduler &sc){
+    Future<std::string> s = sc.async([](){ return 20; })
+        .then([](int x){ return x + 1; }, &sc)
+        .then([](int x){ return std::to_string(x) + "!"; }, &sc);
+    CHECK(s.get() == "21!");
+
+    std::atomic<int> calls(0);
+    Future<int> e = sc.async([]()->int{ throw std::runtime_error("boom"); })
+        .then([&calls](int x){ ++calls; return x + 1; }, &sc)
+        .then([&calls](int x){ ++calls; return x * 2; }, &sc);
+    CHECK(throws(e, "boom"));
+    CHECK(calls.load() == 0);
+
+    //*fn自己抛出的异常传给下一步
+    Future<int> thrown = sc.async([](){ return 1; })
+        .then([](int)->int{ throw std::runtime_error("in then"); }, &sc);
+    CHECK(throws(thrown, "in then"));
+
+    //*没有设置就析构的Promise
+    Future<int> broken;
+    {
+        Promise<int> promise;
+        broken = promise.getFuture();
+    }
+    CHECK(throws(broken, "broken promise"));
+}
+
+//*对已经就绪的Future链式调用then：不经过调度器时在调用线程里立即执行
+static void testThenOnReady(Scheduler &sc){
+    Promise<int> promise;
+    Future<int> future = promise.getFuture();
+    promise.setValue(5);
+    std::thread::id runner;
+    Future<int> chained = future.then([&runner](int x){ runner = std::this_thread::get_id(); return x * 2; }, nullptr)
+        .then([](int x){ return x + 1; }, nullptr);
+    CHECK(runner == std::this_thread::get_id());
+    CHECK(chained.isReady());
+    CHECK(chained.get() == 11);
+
+    //*交给调度器时在工作线程里执行
+    Promise<void> ready;
+    Future<void> v = ready.getFuture();
+    ready.setValue();
+    Future<int> scheduled = v.then([&runner](){ runner = std::this_thread::get_id(); return 7; }, &sc)
+        .then([](int x){ return x + 1; }, &sc);
+    CHECK(scheduled.get() == 8);
+    CHECK(runner != std::this_thread::get_id());
+}
+
+//*whenAll等全部就绪，出错的输入不影响组合结果，在各自get()时抛出
+static void testWhenAll(Scheduler &sc){
+    std::vector<Future<int>> futures;
+    for(int i = 0; i < 10; ++i){
+        futures.push_back(sc.async([i]()->int{
+            usleep(1000 * (10 - i));
+            if(i == 3)
+                throw std::runtime_error("three");
+            return i;
+        }));
+    }
+    Future<void> all = whenAll(futures);
+    all.get();
+    int sum = 0;
+    for(int i = 0; i < 10; ++i){
+        CHECK(futures[i].isReady());
+        if(i == 3)
+            CHECK(throws(futures[i], "three"));
+        else
+            sum += futures[i].get();
+    }
+    CHECK(sum == 45 - 3);
+
+    //*输入全部已经就绪
+    std::vector<Future<int>> ready;
+    for(int i = 0; i < 3; ++i){
+        Promise<int> promise;
+        ready.push_back(promise.getFuture());
+        promise.setValue(i);
+    }
+    Future<void> done = whenAll(ready);
+    CHECK(done.isReady());
+}
+
+//*whenAny取第一个就绪的；落后的输入之后才完成，组合结果和它自己的值都不受影响
+static void testWhenAny(){
+    Promise<int> slow, fast;
+    std::vector<Future<int>> futures;
+    futures.push_back(slow.getFuture());
+    futures.push_back(fast.getFuture());
+    Future<size_t> any = whenAny(futures);
+    CHECK(!any.isReady());
+    fast.setValue(2);
+    CHECK(any.isReady());
+    slow.setValue(1);
+    CHECK(any.get() == 1);
+    CHECK(futures[0].get() == 1);
+    CHECK(futures[1].get() == 2);
+
+    //*第一个就绪的是异常，组合结果仍然是它的序号
+    Promise<int> bad, late;
+    std::vector<Future<int>> mixed;
+    mixed.push_back(late.getFuture());
+    mixed.push_back(bad.getFuture());
+    Future<size_t> first = whenAny(mixed);
+    bad.setException(std::make_exception_ptr(std::runtime_error("bad")));
+    CHECK(first.get() == 1);
+    CHECK(throws(mixed[1], "bad"));
+    //*组合结果已经取走之后落后的输入才完成
+    late.setValue(3);
+    CHECK(mixed[0].get() == 3);
+}
+
+int main(){
+    Scheduler sc(2, false, "future");
+    sc.start();
+    testThen(sc);
+    testThenOnReady(sc);
+    testWhenAll(sc);
+    testWhenAny();
+    sc.stop();
+    if(g_failed)
+        return 1;
+    printf("future ok\n");
+    return 0;
+}
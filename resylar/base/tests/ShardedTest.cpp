@@ -0,0 +1,89 @@
+#include "../sharded_iomanager.h"
+#include <atomic>
+#include <cstdio>
+#include <unistd.h>
+using namespace myconcurrent;
+
+static int g_failed = 0;
+
+#define CHECK(cond) do{ if(!(cond)){ printf("%s:%d check failed: %s\n", __FILE__, __LINE__, #cond); ++g_failed; } }while(0)
+
+/**
+ * *停止时分片1上有协程在等管道可读，分片0上的定时器稍后写管道；分片1醒来后给分片0发消息
+ * *stop()要等IO事件和定时器都结束，分片0不能先停掉把这条消息丢了
+ */
+static void testPostAfterIO(){
+    std::atomic<int> delivered(0);
+    int fds[2];
+    CHECK(pipe(fds) == 0);
+    {
+        ShardedIOManager sharded(2, "io_shard", false);
+        ShardedIOManager *self = &sharded;
+        sharded.submitTo(1, [self, fds, &delivered](){
+            IOManager::GetThis()->addEvent(fds[0], IOManager::READ, [self, fds, &delivered](){
+                char c;
+                CHECK(read(fds[0], &c, 1) == 1);
+                CHECK(self->submitTo(0, [&delivered](){ ++delivered; }));
+            });
+        });
+        sharded.submitTo(0, [fds](){
+            IOManager::GetThis()->addTimer(100, [fds](){
+                CHECK(write(fds[1], "x", 1) == 1);
+            });
+        });
+        //*等两边都注册好
+        usleep(20 * 1000);
+        sharded.stop();
+    }
+    CHECK(delivered.load() == 1);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+/**
+ * *每条消息在下一个分片上继续转发，直到跳数用完；停止过程中仍在转发
+ * *接受的消息都要执行，关闭之后被拒绝的消息不执行
+ */
+static const int kHops = 2000;
+
+struct Relay{
+    ShardedIOManager *sharded;
+    std::atomic<int> *accepted;
+    std::atomic<int> *executed;
+
+    void hop(size_t shard, int left) const{
+        ++*executed;
+        if(left == 0)
+            return;
+        Relay self = *this;
+        size_t next = (shard + 1) % sharded->size();
+        if(sharded->submitTo(next, [self, next, left](){ self.hop(next, left - 1); }))
+            ++*accepted;
+    }
+};
+
+static void testRelayDuringStop(){
+    std::atomic<int> accepted(0), executed(0);
+    {
+        ShardedIOManager sharded(4, "relay_shard", false);
+        Relay relay = {&sharded, &accepted, &executed};
+        for(size_t i = 0; i < 8; ++i){
+            size_t shard = i % sharded.size();
+            if(sharded.submitTo(shard, [relay, shard](){ relay.hop(shard, kHops); }))
+                ++accepted;
+        }
+        sharded.stop();
+        CHECK(!sharded.submitTo(0, [](){}));
+    }
+    CHECK(executed.load() == accepted.load());
+    CHECK(executed.load() == 8 * (kHops + 1));
+}
+
+int main(){
+    testPostAfterIO();
+    testRelayDuringStop();
+    if(g_failed)
+        return 1;
+    printf("sharded ok\n");
+    return 0;
+}
@@ -0,0 +1,70 @@
+#include "../fiber.h"
+#include "../stack_profile.h"
+#include <cstdio>
+using namespace myconcurrent;
+
+static int g_failed = 0;
+
+#define CHECK(cond) do{ if(!(cond)){ printf("%s:%d check failed: %s\n", __FILE__, __LINE__, #cond); ++g_failed; } }while(0)
+
+static const size_t kDefault = 1024 * 1024;
+
+static const char kFew[] = "few";
+static const char kSameFiber[] = "same_fiber";
+static const char kEnough[] = "enough";
+static const char kNotOptedIn[] = "not_opted_in";
+static const char kDeep[] = "deep";
+
+int main(){
+    StackProfile::SetAdaptive(true);
+    StackProfile::ShrinkPolicy policy;
+    policy.headroom = 4;
+    policy.floor = 64 * 1024;
+
+    //*样本不够时不缩小
+    StackProfile::AllowShrink(kFew, policy);
+    for(uint64_t id = 1; id < StackProfile::kMinSamples; ++id)
+        StackProfile::Record(kFew, 4 * 1024, id);
+    CHECK(StackProfile::SuggestSize(kFew, kDefault) == 0);
+
+    //*样本再多，来自同一个协程(reset复用)也不算
+    StackProfile::AllowShrink(kSameFiber, policy);
+    for(int i = 0; i < 100; ++i)
+        StackProfile::Record(kSameFiber, 4 * 1024, 42);
+    CHECK(StackProfile::SuggestSize(kSameFiber, kDefault) == 0);
+
+    //*足够多的不同协程：最高水位的headroom倍向上取2的幂，不低于下限
+    StackProfile::AllowShrink(kEnough, policy);
+    for(uint64_t id = 1; id <= StackProfile::kMinSamples; ++id)
+        StackProfile::Record(kEnough, 4 * 1024, id);
+    CHECK(StackProfile::SuggestSize(kEnough, kDefault) == 64 * 1024);
+    StackProfile::Record(kEnough, 30 * 1024, 100);
+    CHECK(StackProfile::SuggestSize(kEnough, kDefault) == 128 * 1024);
+    CHECK(Fiber::StackSizeFor(kEnough) == 128 * 1024);
+
+    //*没有允许缩小的标签不会低于默认大小
+    for(uint64_t id = 1; id <= 2 * StackProfile::kMinSamples; ++id)
+        StackProfile::Record(kNotOptedIn, 4 * 1024, id);
+    CHECK(StackProfile::SuggestSize(kNotOptedIn, kDefault) == 0);
+    CHECK(Fiber::StackSizeFor(kNotOptedIn) == kDefault);
+
+    //*放大不需要等样本
+    StackProfile::Record(kDeep, 700 * 1024, 1);
+    CHECK(StackProfile::SuggestSize(kDeep, kDefault) == 2 * 1024 * 1024);
+
+    //*关闭自适应后都用默认大小
+    StackProfile::SetAdaptive(false);
+    CHECK(StackProfile::SuggestSize(kEnough, kDefault) == 0);
+    CHECK(StackProfile::SuggestSize(kDeep, kDefault) == 0);
+
+    for(auto &stats : StackProfile::GetStats()){
+        if(stats.tag == kEnough)
+            CHECK(stats.shrink && stats.suggested == 128 * 1024);
+        if(stats.tag == kNotOptedIn)
+            CHECK(!stats.shrink);
+    }
+    if(g_failed)
+        return 1;
+    printf("stack profile ok\n");
+    return 0;
+}
@@ -0,0 +1,73 @@
+#include "../iomanager.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+using namespace myconcurrent;
+
+static int g_failed = 0;
+
+#define CHECK(cond) do{ if(!(cond)){ printf("%s:%d check failed: %s\n", __FILE__, __LINE__, #cond); ++g_failed; } }while(0)
+
+static uint64_t nowMs(){
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+               std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * *限时停止到期：协程阻塞在永远不会有数据的管道上，循环定时器一直不结束，另一个任务一直在执行
+ * *到期后事件被取消、定时器被提前触发，协程带着错误返回，报告里分开统计排队的任务和执行中的线程
+ */
+int main(){
+    int fds[2];
+    CHECK(pipe(fds) == 0);
+    fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+
+    std::atomic<bool> resumed(false), registered(false);
+    std::atomic<int> readErrno(0), reAdd(0), ticks(0);
+    Scheduler::StopReport report;
+    {
+        IOManager iom(2, false, "deadline");
+        iom.schedule([&](){
+            IOManager *io = IOManager::GetThis();
+            CHECK(io->addEvent(fds[0], IOManager::READ) == 0);
+            registered = true;
+            Fiber::GetThis()->yield();
+            //*被取消唤醒，没有数据
+            char c;
+            if(read(fds[0], &c, 1) < 0)
+                readErrno = errno;
+            //*到期后不能再注册事件
+            reAdd = io->addEvent(fds[0], IOManager::READ);
+            resumed = true;
+        });
+        iom.addTimer(10, [&ticks](){ ++ticks; }, true);
+        std::atomic<bool> spinning(false);
+        iom.schedule([&spinning](){
+            spinning = true;
+            uint64_t end = nowMs() + 300;
+            while(nowMs() < end)
+                ;
+        });
+        while(!registered || !spinning)
+            usleep(1000);
+
+        report = iom.stop(50);
+    }
+    CHECK(!report.drained);
+    CHECK(report.cancelledEvents == 1);
+    CHECK(report.expiredTimers >= 1);
+    CHECK(report.activeThreads == 1);
+    CHECK(resumed.load());
+    CHECK(readErrno.load() == EAGAIN);
+    CHECK(reAdd.load() != 0);
+    CHECK(ticks.load() >= 1);
+    close(fds[0]);
+    close(fds[1]);
+    if(g_failed)
+        return 1;
+    printf("stop deadline ok\n");
+    return 0;
+}
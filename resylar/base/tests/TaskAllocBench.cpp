@@ -0,0 +1,77 @@
+#include "../scheduler.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <unistd.h>
+using namespace myconcurrent;
+
+//*统计全局堆分配次数，用来确认稳定运行时调度路径不分配内存
+static std::atomic<uint64_t> g_allocs(0);
+
+void *operator new(size_t n){
+    ++g_allocs;
+    if(void *p = malloc(n ? n : 1))
+        return p;
+    throw std::bad_alloc();
+}
+void operator delete(void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+
+static std::atomic<uint64_t> g_done(0);
+
+//*48字节的捕获，在TaskFunc的缓冲区内
+struct Payload{
+    uint64_t v[6];
+};
+
+static void chain(Payload p, int left){
+    g_done.fetch_add(1, std::memory_order_relaxed);
+    if(left > 0){
+        //*工作线程内提交，走本地队列
+        Scheduler::GetThis()->schedule([p, left](){ chain(p, left - 1); });
+    }
+}
+
+static uint64_t runRound(Scheduler &sc, int outside, int depth){
+    uint64_t target = g_done.load() + (uint64_t)outside * (depth + 1);
+    Payload p = {{1, 2, 3, 4, 5, 6}};
+    for(int i = 0; i < outside; ++i){
+        //*外部线程提交，走全局注入队列
+        sc.schedule([p, depth](){ chain(p, depth); });
+    }
+    while(g_done.load() < target)
+        usleep(100);
+    return (uint64_t)outside * (depth + 1);
+}
+
+int main(int argc, char *argv[]){
+    struct Capture{
+        Payload p;
+        int left;
+    };
+    static_assert(TaskFunc::FitsInline<Capture>(), "task capture should fit inline");
+    int threads = argc > 1 ? atoi(argv[1]) : 4;
+    const int outside = 256, depth = 16, rounds = 200;
+
+    Scheduler sc(threads, false, "bench");
+    sc.start();
+    //*预热：让各个队列、工作协程的栈都分配到位
+    for(int i = 0; i < 20; ++i)
+        runRound(sc, outside, depth);
+
+    uint64_t before = g_allocs.load();
+    uint64_t tasks = 0;
+    auto start = std::chrono::steady_clock::now();
+    for(int i = 0; i < rounds; ++i)
+        tasks += runRound(sc, outside, depth);
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    uint64_t allocs = g_allocs.load() - before;
+
+    sc.stop();
+    printf("threads=%d tasks=%llu allocs=%llu allocs_per_task=%.6f ns_per_task=%.1f\n",
+           threads, (unsigned long long)tasks, (unsigned long long)allocs,
+           (double)allocs / tasks, (double)ns / tasks);
+    return allocs == 0 ? 0 : 1;
+}
@@ -0,0 +1,90 @@
+#include "../scheduler.h"
+#include <atomic>
+#include <cstdio>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+using namespace myconcurrent;
+
+static int g_failed = 0;
+
+#define CHECK(cond) do{ if(!(cond)){ printf("%s:%d check failed: %s\n", __FILE__, __LINE__, #cond); ++g_failed; } }while(0)
+
+//*外部线程和工作协程里的run()/wait()
+static void testRunWait(Scheduler &sc){
+    std::atomic<int> sum(0);
+    TaskGroup group(&sc);
+    for(int i = 1; i <= 100; ++i)
+        CHECK(group.run([&sum, i](){ sum += i; }));
+    group.wait();
+    CHECK(sum.load() == 5050);
+    CHECK(group.pending() == 0);
+
+    //*在协程里等待只让出协程，嵌套的任务组也能完成
+    std::atomic<bool> done(false);
+    sc.schedule([&sc, &done](){
+        std::atomic<int> inner(0);
+        TaskGroup g(&sc);
+        for(int i = 0; i < 50; ++i)
+            g.run([&inner](){ ++inner; });
+        g.wait();
+        CHECK(inner.load() == 50);
+        done = true;
+    });
+    while(!done)
+        usleep(100);
+}
+
+static void testParallelFor(Scheduler &sc){
+    std::vector<int> out(10000, 0);
+    sc.parallelFor(0, out.size(), 0, [&out](size_t i){ out[i] = (int)i * 2; });
+    long long sum = 0;
+    for(size_t i = 0; i < out.size(); ++i)
+        sum += out[i];
+    CHECK(sum == 9999LL * 10000);
+}
+
+//*限时停止中外部提交被拒绝，run()返回false，wait()不会卡住，parallelFor退化为调用者执行
+static void testRejected(){
+    Scheduler sc(1, false, "tg_stop");
+    sc.start();
+    std::atomic<bool> release(false);
+    sc.schedule([&release](){
+        while(!release)
+            usleep(1000);
+    });
+    std::thread stopper([&sc](){ sc.stop(2000); });
+    usleep(100 * 1000);
+
+    TaskGroup group(&sc);
+    std::atomic<int> ran(0);
+    CHECK(!group.run([&ran](){ ++ran; }));
+    CHECK(group.pending() == 0);
+    group.wait();
+
+    std::vector<int> out(100, 0);
+    sc.parallelFor(0, out.size(), 10, [&out](size_t i){ out[i] = 1; });
+    int sum = 0;
+    for(size_t i = 0; i < out.size(); ++i)
+        sum += out[i];
+    CHECK(sum == 100);
+
+    release = true;
+    stopper.join();
+    CHECK(ran.load() == 0);
+}
+
+int main(){
+    {
+        Scheduler sc(4, false, "tg");
+        sc.start();
+        testRunWait(sc);
+        testParallelFor(sc);
+        sc.stop();
+    }
+    testRejected();
+    if(g_failed)
+        return 1;
+    printf("task group ok\n");
+    return 0;
+}
@@ -0,0 +1,26 @@
+#include "../iomanager.h"
+#include <atomic>
+#include <cstdio>
+#include <unistd.h>
+using namespace myconcurrent;
+
+//*循环定时器的回调比周期长时，同一个回调不会被并发调用，回调里的可变状态不用加锁
+int main(){
+    std::atomic<int> inside(0), overlap(0), fired(0);
+    int state = 0;
+    {
+        IOManager iom(4, false, "timer");
+        Timer::ptr timer = iom.addTimer(1, [&inside, &overlap, &fired, state]() mutable {
+            if(inside.fetch_add(1) != 0)
+                ++overlap;
+            ++state;
+            usleep(5000);
+            ++fired;
+            inside.fetch_sub(1);
+        }, true);
+        usleep(200 * 1000);
+        timer->cancel();
+    }
+    printf("fired=%d overlap=%d\n", fired.load(), overlap.load());
+    return overlap.load() == 0 && fired.load() > 10 ? 0 : 1;
+}
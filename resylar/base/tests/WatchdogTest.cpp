@@ -0,0 +1,92 @@
+#include "../scheduler.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+using namespace myconcurrent;
+
+static int g_failed = 0;
+
+#define CHECK(cond) do{ if(!(cond)){ printf("%s:%d check failed: %s\n", __FILE__, __LINE__, #cond); ++g_failed; } }while(0)
+
+static volatile sig_atomic_t g_userSignals = 0;
+
+//*程序自己的处理函数，看门狗运行期间非工作线程收到的信号还要转到这里，停止后恢复
+static void onUserSignal(int){
+    ++g_userSignals;
+}
+
+static uint64_t nowMs(){
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+               std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void installUserHandler(int signo){
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = &onUserSignal;
+    sigemptyset(&sa.sa_mask);
+    sigaction(signo, &sa, nullptr);
+}
+
+static bool handlerIs(int signo, void (*handler)(int)){
+    struct sigaction sa;
+    sigaction(signo, nullptr, &sa);
+    return sa.sa_handler == handler;
+}
+
+//*卡住工作线程超过阈值，看门狗报告一次；停止后信号的处理方式恢复原样
+static void testStall(int signo){
+    installUserHandler(signo);
+    {
+        Scheduler sc(1, false, "watchdog");
+        sc.start();
+        sc.setWatchdog(30, 0);
+        CHECK(!handlerIs(signo, &onUserSignal));
+        CHECK(!Scheduler::SetBacktraceSignal(SIGRTMIN + 5));
+        //*不是工作线程收到的转给原来的处理函数
+        raise(signo);
+        CHECK(g_userSignals == 1);
+
+        std::atomic<bool> done(false);
+        sc.schedule([&done](){
+            uint64_t end = nowMs() + 150;
+            while(nowMs() < end)
+                ;
+            done = true;
+        });
+        while(!done)
+            usleep(1000);
+        //*看门狗可能还在等调用栈
+        usleep(50 * 1000);
+        Scheduler::Stats stats = sc.getStats();
+        CHECK(stats.workers.size() == 1 && stats.workers[0].slowTasks == 1);
+        sc.stop();
+    }
+    CHECK(handlerIs(signo, &onUserSignal));
+    raise(signo);
+    CHECK(g_userSignals == 2);
+}
+
+int main(){
+    struct sigaction urg;
+    sigaction(SIGURG, nullptr, &urg);
+
+    //*默认的信号
+    testStall(SIGRTMIN + 2);
+    //*换成别的信号
+    CHECK(Scheduler::SetBacktraceSignal(SIGRTMIN + 4));
+    g_userSignals = 0;
+    testStall(SIGRTMIN + 4);
+
+    //*不再动SIGURG
+    struct sigaction after;
+    sigaction(SIGURG, nullptr, &after);
+    CHECK(after.sa_handler == urg.sa_handler);
+    if(g_failed)
+        return 1;
+    printf("watchdog ok\n");
+    return 0;
+}
@@ -23,12 +23,17 @@ namespace myconcurrent{
 }
 
 
-Timer::Timer(uint64_t ms, std::function<void()> cb,
+Timer::Timer(uint64_t ms, TaskFunc cb,
              bool recurring, TimerManager* manager)
     :m_recurring(recurring)
     ,m_ms(ms)
-    ,m_cb(cb)
     ,m_manager(manager) {
+    if(recurring) {
+        m_recurringCb = std::make_shared<Recurring>();
+        m_recurringCb->cb = std::move(cb);
+    } else {
+        m_cb = std::move(cb);
+    }
     m_next = myconcurrent::GetElapsedMS() + m_ms;
 }
 
@@ -36,10 +41,15 @@ Timer::Timer(uint64_t next)
     :m_next(next) {
 }
 
+void Timer::clearCb() {
+    m_cb = nullptr;
+    m_recurringCb.reset();
+}
+
 bool Timer::cancel() {
     MutexLockGuard Mutex( m_manager->m_mutex);
-    if(m_cb) {
-        m_cb = nullptr;
+    if(hasCb()) {
+        clearCb();
         auto it = m_manager->m_timers.find(shared_from_this());
         m_manager->m_timers.erase(it);
         return true;
@@ -49,7 +59,7 @@ bool Timer::cancel() {
 
 bool Timer::refresh() {
     MutexLockGuard lock(m_manager->m_mutex);
-    if(!m_cb) {
+    if(!hasCb()) {
         return false;
     }
     auto it = m_manager->m_timers.find(shared_from_this());
@@ -67,7 +77,7 @@ bool Timer::reset(uint64_t ms, bool from_now) {
         return true;
     }
     MutexLockGuard lock(m_manager->m_mutex);
-    if(!m_cb) {
+    if(!hasCb()) {
         return false;
     }
     auto it = m_manager->m_timers.find(shared_from_this());
@@ -96,28 +106,49 @@ TimerManager::TimerManager() {
 TimerManager::~TimerManager() {
 }
 
-Timer::ptr TimerManager::addTimer(uint64_t ms, std::function<void()> cb
+Timer::ptr TimerManager::addTimer(uint64_t ms, TaskFunc cb
                                   ,bool recurring) {
-    Timer::ptr timer(new Timer(ms, cb, recurring, this));
+    Timer::ptr timer(new Timer(ms, std::move(cb), recurring, this));
     MutexLockGuard lock(m_mutex);
     MutexLock wlock;
     addTimer(timer, wlock);
     return timer;
 }
 
-static void OnTimer(std::weak_ptr<void> weak_cond, std::function<void()> cb) {
-    std::shared_ptr<void> tmp = weak_cond.lock();
-    if(tmp) {
-        cb();
-    }
-}
-
-Timer::ptr TimerManager::addConditionTimer(uint64_t ms, std::function<void()> cb
+Timer::ptr TimerManager::addConditionTimer(uint64_t ms, TaskFunc cb
                                     ,std::weak_ptr<void> weak_cond
                                     ,bool recurring) {
-    return addTimer(ms, std::bind(&OnTimer, weak_cond, cb), recurring);
+    //*条件放在定时器里，超时时检查，避免再包一层回调
+    Timer::ptr timer(new Timer(ms, std::move(cb), recurring, this));
+    timer->m_cond = std::move(weak_cond);
+    timer->m_hasCond = true;
+    MutexLockGuard lock(m_mutex);
+    MutexLock wlock;
+    addTimer(timer, wlock);
+    return timer;
 }
 
+struct Timer::RecurringCall {
+    std::shared_ptr<Recurring> state;
+
+    explicit RecurringCall(std::shared_ptr<Recurring> s) : state(std::move(s)) {}
+    RecurringCall(RecurringCall&& other) noexcept : state(std::move(other.state)) {}
+    RecurringCall(const RecurringCall&) = delete;
+    RecurringCall& operator=(const RecurringCall&) = delete;
+    //*停止时任务可能没有执行就被丢弃，同样要放开，之后的超时才能继续调度
+    ~RecurringCall() {
+        if(state) {
+            state->running.store(false, std::memory_order_release);
+        }
+    }
+
+    void operator()() {
+        state->cb();
+        state->running.store(false, std::memory_order_release);
+        state.reset();
+    }
+};
+
 uint64_t TimerManager::getNextTimer() {
     MutexLockGuard lock(m_mutex);
     m_tickled = false;
@@ -134,7 +165,7 @@ uint64_t TimerManager::getNextTimer() {
     }
 }
 
-void TimerManager::listExpiredCb(std::vector<std::function<void()> >& cbs) {
+void TimerManager::listExpiredCb(std::vector<TaskFunc>& cbs) {
     uint64_t now_ms = myconcurrent::GetElapsedMS();
     std::vector<Timer::ptr> expired;
     {
@@ -163,14 +194,21 @@ void TimerManager::listExpiredCb(std::vector<std::function<void()> >& cbs) {
     }
     expired.insert(expired.begin(), m_timers.begin(), it);
     m_timers.erase(m_timers.begin(), it);
-    cbs.reserve(expired.size());
+    cbs.reserve(cbs.size() + expired.size());
 
     for(auto& timer : expired) {
-        cbs.push_back(timer->m_cb);
+        bool alive = !timer->m_hasCond || !timer->m_cond.expired();
         if(timer->m_recurring) {
+            //*上一次回调还在排队或执行时跳过这一次
+            if(alive && !timer->m_recurringCb->running.exchange(true, std::memory_order_acq_rel)) {
+                cbs.push_back(Timer::RecurringCall(timer->m_recurringCb));
+            }
             timer->m_next = now_ms + timer->m_ms;
             m_timers.insert(timer);
         } else {
+            if(alive) {
+                cbs.push_back(std::move(timer->m_cb));
+            }
             timer->m_cb = nullptr;
         }
     }
@@ -198,6 +236,21 @@ bool TimerManager::detectClockRollover(uint64_t now_ms) {
     return rollover;
 }
 
+size_t TimerManager::expireAll(std::vector<TaskFunc>& cbs) {
+    MutexLockGuard lock(m_mutex);
+    size_t n = m_timers.size();
+    for(auto& timer : m_timers) {
+        //*等待超时的协程在回调里被唤醒，提前触发而不是丢弃，协程才有机会结束
+        bool alive = !timer->m_hasCond || !timer->m_cond.expired();
+        if(alive && !timer->m_recurring) {
+            cbs.push_back(std::move(timer->m_cb));
+        }
+        timer->clearCb();
+    }
+    m_timers.clear();
+    return n;
+}
+
 bool TimerManager::hasTimer() {
     MutexLockGuard lock(m_mutex);
     return !m_timers.empty();
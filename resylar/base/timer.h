@@ -1,14 +1,15 @@
 #pragma once
 
+#include <atomic>
 #include <memory>
 #include <vector>
 #include <set>
-#include <functional>
 #include "MutexLock.h"
+#include "inplace_task.h"
 
 namespace myconcurrent{
 
-uint64_t GetElapsedMS() {
+inline uint64_t GetElapsedMS() {
     struct timespec ts = {0};
     clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
     return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
@@ -48,13 +49,23 @@ private:
      * @param[in] recurring 是否循环
      * @param[in] manager 定时器管理器
      */
-    Timer(uint64_t ms, std::function<void()> cb,
+    Timer(uint64_t ms, TaskFunc cb,
           bool recurring, TimerManager* manager);
     /**
      * @brief 构造函数
      * @param[in] next 执行的时间戳(毫秒)
      */
     Timer(uint64_t next);
+
+    /**
+     * @brief 定时器是否还有效(没有被取消、一次性定时器没有超时)
+     */
+    bool hasCb() const { return m_cb || m_recurringCb; }
+
+    /**
+     * @brief 清除回调
+     */
+    void clearCb();
 private:
     /// 是否循环定时器
     bool m_recurring = false;
@@ -62,8 +73,23 @@ private:
     uint64_t m_ms = 0;
     /// 精确的执行时间
     uint64_t m_next = 0;
-    /// 回调函数
-    std::function<void()> m_cb;
+    /// 回调函数，一次性定时器超时时直接移动出去，不拷贝
+    TaskFunc m_cb;
+    /**
+     * *循环定时器的回调和它是否正在执行
+     * *每次超时只增加引用计数，不拷贝回调；上一次还没执行完时跳过这一次，回调不会被并发调用
+     */
+    struct Recurring {
+        TaskFunc cb;
+        std::atomic<bool> running{false};
+    };
+    /// 调度出去的一次循环定时器回调，执行完或者被丢弃时清除running
+    struct RecurringCall;
+    std::shared_ptr<Recurring> m_recurringCb;
+    /// 条件定时器的条件，超时时条件已经失效就不执行回调
+    std::weak_ptr<void> m_cond;
+    /// 是否条件定时器
+    bool m_hasCond = false;
     /// 定时器管理器
     TimerManager* m_manager = nullptr;
 private:
@@ -104,7 +130,7 @@ public:
      ** cb 定时器回调函数
      ** recurring 是否循环定时器
      */
-    Timer::ptr addTimer(uint64_t ms, std::function<void()> cb
+    Timer::ptr addTimer(uint64_t ms, TaskFunc cb
                         ,bool recurring = false);
 
     /**
@@ -114,7 +140,7 @@ public:
      * * weak_cond 条件
      * * recurring 是否循环
      */
-    Timer::ptr addConditionTimer(uint64_t ms, std::function<void()> cb
+    Timer::ptr addConditionTimer(uint64_t ms, TaskFunc cb
                         ,std::weak_ptr<void> weak_cond
                         ,bool recurring = false);
 
@@ -125,14 +151,21 @@ public:
 
     /**
      * @brief 获取需要执行的定时器的回调函数列表
-     * @param[out] cbs 回调函数数组
+     * @param[out] cbs 回调函数数组，回调追加在末尾
      */
-    void listExpiredCb(std::vector<std::function<void()> >& cbs);
+    void listExpiredCb(std::vector<TaskFunc>& cbs);
 
     /**
      * @brief 是否有定时器
      */
     bool hasTimer();
+
+    /**
+     * @brief 清空所有定时器，用于停止时不再等待
+     * @param[out] cbs 一次性定时器的回调提前触发，追加在末尾；循环定时器直接丢弃
+     * @return 清掉的定时器数
+     */
+    size_t expireAll(std::vector<TaskFunc>& cbs);
 protected:
 
     /**